@@ -0,0 +1,1028 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bp_inline.h"
+
+#define BP_MAX_INDEX_BITS 32
+
+#define BP_MAX_PERCEPTRON_BITS 24
+#define BP_TABLE_ALIGN 64
+#define BP_TABLE_SLACK 2               /* readable bytes past a table, for the TAGE entry gather */
+#define BP_LOCAL_MAX_HISTORY 24
+#define BP_LOCAL_MAX_ENTRY_BITS 24
+#define BP_LOCAL_LOOKAHEAD 8
+#define BP_STATE_MAGIC 0x54535042u     /* "BPST" */
+#define BP_STATE_VERSION 1
+
+static const char *bp_names[] = { "bimodal", "gshare", "hybrid", "perceptron", "tage", "local", "tournament", "loop" };
+
+static const char *table_names[BP_NUM_TABLES] = { "CHOOSER", "GSHARE", "BIMODAL", "PERCEPTRON", "TAGE", "LOCAL_HISTORY", "LOCAL", "LOOP" };
+
+static const char *table_keys[BP_NUM_TABLES] = { "chooser", "gshare", "bimodal", "perceptron", "tage", "local_history", "local", "loop" };
+
+static const char *policy_names[BP_NUM_POLICIES] = { "chosen", "both", "disagree" };
+
+static const char *isa_names[BP_NUM_ISAS] = { "auto", "scalar", "avx2", "sse4.2", "avx512" };
+
+static const unsigned char table_init[BP_NUM_TABLES] = { 1, 2, 2, 0, 0, 0, 2, 0 };
+
+ /**
+ * Maps a predictor name from the command line to its type.
+ * Returns 0 on success, -1 if the name is unknown.
+ */
+
+int bp_type_from_name(const char *name, bp_type *type) {
+    for (int i = 0; i < (int)(sizeof(bp_names) / sizeof(bp_names[0])); i++) {
+        if (strcmp(name, bp_names[i]) == 0) {
+            *type = (bp_type)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *bp_type_name(bp_type type) {
+    return bp_names[type];
+}
+
+const char *bp_table_name(bp_table_id id) {
+    return table_keys[id];
+}
+
+ /**
+ * Maps a hybrid/tournament update policy name to its value.
+ * Returns 0 on success, -1 if the name is unknown.
+ */
+
+int bp_policy_from_name(const char *name, bp_update_policy *policy) {
+    for (int i = 0; i < BP_NUM_POLICIES; i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = (bp_update_policy)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *bp_policy_name(bp_update_policy policy) {
+    return policy_names[policy];
+}
+
+ /**
+ * Maps an instruction set name ("auto", "scalar", "sse4.2", "avx2" or
+ * "avx512") to its value. Returns 0 on success, -1 if the name is unknown.
+ */
+
+int bp_isa_from_name(const char *name, bp_isa *isa) {
+    for (int i = 0; i < BP_NUM_ISAS; i++) {
+        if (strcmp(name, isa_names[i]) == 0) {
+            *isa = (bp_isa)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *bp_isa_name(bp_isa isa) {
+    return isa_names[isa];
+}
+
+ /**
+ * Returns nonzero if this CPU (and OS) can run the kernels built for isa.
+ * The AVX-512 kernels need the byte and word instructions (AVX512BW). Off
+ * x86 only the scalar kernels are built.
+ */
+
+int bp_isa_supported(bp_isa isa) {
+    switch (isa) {
+    case BP_ISA_AUTO:
+    case BP_ISA_SCALAR:
+        return 1;
+#if defined(__x86_64__) || defined(__i386__)
+    case BP_ISA_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case BP_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case BP_ISA_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return 0;
+    }
+}
+
+ /**
+ * Returns the widest instruction set this CPU supports, which is what
+ * BP_ISA_AUTO selects.
+ */
+
+bp_isa bp_isa_best(void) {
+    static const bp_isa order[] = { BP_ISA_AVX512, BP_ISA_AVX2, BP_ISA_SSE42 };
+    for (int i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++) {
+        if (bp_isa_supported(order[i])) return order[i];
+    }
+    return BP_ISA_SCALAR;
+}
+
+ /**
+ * Checks that the geometry needed by the predictor type is usable.
+ * Gshare history either fits inside the M1 index bits or, up to
+ * BP_HISTORY_MAX bits, is folded into them; a perceptron's
+ * history plus bias must fit in one 64-lane weight row. TAGE's longest
+ * history must leave room in its circular buffer for speculative rollback.
+ * A local history must fit one unaligned 8-byte read of the packed table.
+ * A tournament combines two different counter-based components, each of
+ * which must be valid on its own. The loop override only applies on top of
+ * counter-based predictors.
+ */
+
+static int component_valid(const bp_config *c, bp_type type);
+
+static int gshare_valid(const bp_config *c) {
+    return c->M1 <= BP_MAX_INDEX_BITS &&
+           (c->N <= c->M1 || (c->M1 >= 1 && c->M1 < BP_MAX_INDEX_BITS && c->N <= BP_HISTORY_MAX));
+}
+
+static int config_valid(const bp_config *c) {
+    if ((unsigned int)c->policy >= BP_NUM_POLICIES) return 0;
+    if (c->E > BP_LOOP_MAX_BITS || (c->E && (c->type == BP_PERCEPTRON || c->type == BP_TAGE))) return 0;
+    switch (c->type) {
+        case BP_BIMODAL:
+            return c->M2 <= BP_MAX_INDEX_BITS;
+        case BP_GSHARE:
+            return gshare_valid(c);
+        case BP_HYBRID:
+            return c->K <= BP_MAX_INDEX_BITS && c->M2 <= BP_MAX_INDEX_BITS && gshare_valid(c);
+        case BP_PERCEPTRON:
+            return c->P <= BP_MAX_PERCEPTRON_BITS && c->H >= 1 && c->H <= BP_PERCEPTRON_MAX_H && c->theta >= 0;
+        case BP_TAGE:
+            return c->M2 <= BP_MAX_INDEX_BITS && c->T >= 1 && c->T <= BP_TAGE_MAX_TABLES &&
+                   c->B >= 1 && c->B <= BP_TAGE_MAX_INDEX && c->Lmin >= 1 && c->Lmin <= c->Lmax &&
+                   c->Lmax <= BP_HISTORY_MAX;
+        case BP_LOCAL:
+            return c->L <= BP_LOCAL_MAX_ENTRY_BITS && c->H >= 1 && c->H <= BP_LOCAL_MAX_HISTORY &&
+                   c->H + c->S <= BP_MAX_INDEX_BITS;
+        case BP_TOURNAMENT:
+            return c->K <= BP_MAX_INDEX_BITS && c->first != c->second &&
+                   component_valid(c, c->first) && component_valid(c, c->second);
+        case BP_LOOP:
+            return c->E >= 1;
+    }
+    return 0;
+}
+
+static int component_valid(const bp_config *c, bp_type type) {
+    bp_config component = *c;
+    if (type != BP_BIMODAL && type != BP_GSHARE && type != BP_LOCAL) return 0;
+    component.type = type;
+    return config_valid(&component);
+}
+
+static size_t table_bytes(size_t size) {
+    return (size + BP_TABLE_SLACK + BP_TABLE_ALIGN - 1) & ~(size_t)(BP_TABLE_ALIGN - 1);
+}
+
+static unsigned char *table_alloc(size_t size) {
+    return (unsigned char*)aligned_alloc(BP_TABLE_ALIGN, table_bytes(size));
+}
+
+ /**
+ * Empties the history of every thread and makes thread 0 the running one.
+ */
+
+static void clear_histories(bp_predictor *bp) {
+    memset(bp->contexts, 0, bp->thread_count * sizeof(bp_thread_context));
+    bp->thread = 0;
+    bp->history = &bp->contexts[0].history;
+    bp->global_history = 0;
+    memset(bp->tage.fold, 0, sizeof(bp->tage.fold));
+}
+
+static size_t dirty_words(size_t size) {
+    return ((size + BP_DIRTY_BLOCK - 1) / BP_DIRTY_BLOCK + 63) / 64;
+}
+
+static void fill_tables(bp_predictor *bp) {
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (bp->tables[t]) memset(bp->tables[t], table_init[t], bp->sizes[t]);
+        if (bp->dirty[t]) memset(bp->dirty[t], 0, dirty_words(bp->sizes[t]) * sizeof(uint64_t));
+    }
+    clear_histories(bp);
+    if (bp->config.type == BP_TAGE) bp_tage_reset(&bp->tage);
+    bp->stats.predictions = 0;
+    bp->stats.mispredictions = 0;
+}
+
+ /**
+ * Fills sizes with the byte size of every table config needs, 0 for the
+ * tables it does not use.
+ */
+
+static void table_sizes(const bp_config *config, size_t *sizes) {
+    int tournament = config->type == BP_TOURNAMENT;
+    int uses_local = config->type == BP_LOCAL || (tournament && (config->first == BP_LOCAL || config->second == BP_LOCAL));
+    int uses_bimodal = config->type == BP_BIMODAL || config->type == BP_HYBRID || config->type == BP_TAGE ||
+                       (tournament && (config->first == BP_BIMODAL || config->second == BP_BIMODAL));
+    int uses_gshare = config->type == BP_GSHARE || config->type == BP_HYBRID ||
+                      (tournament && (config->first == BP_GSHARE || config->second == BP_GSHARE));
+    memset(sizes, 0, BP_NUM_TABLES * sizeof(size_t));
+    if (config->type == BP_PERCEPTRON) sizes[BP_TABLE_PERCEPTRON] = (1UL << config->P) * BP_PERCEPTRON_ROW;
+    if (config->type == BP_TAGE) sizes[BP_TABLE_TAGE] = (config->T << config->B) * sizeof(uint16_t);
+    if (uses_local) {
+        sizes[BP_TABLE_LOCAL_HISTORY] = ((config->H << config->L) + 7) / 8 + sizeof(uint64_t);
+        sizes[BP_TABLE_LOCAL] = 1UL << (config->H + config->S);
+    }
+    if (config->E) sizes[BP_TABLE_LOOP] = (1UL << config->E) * sizeof(uint64_t);
+    if (config->type == BP_HYBRID || tournament) sizes[BP_TABLE_CHOOSER] = 1UL << config->K;
+    if (uses_gshare) sizes[BP_TABLE_GSHARE] = 1UL << config->M1;
+    if (uses_bimodal) sizes[BP_TABLE_BIMODAL] = 1UL << config->M2;
+}
+
+ /**
+ * Returns the memory in bytes a predictor for config occupies once created
+ * (tables rounded up to their allocation, plus the predictor itself), or 0
+ * if the configuration is invalid. Nothing is allocated.
+ */
+
+size_t bp_footprint(const bp_config *config) {
+    size_t sizes[BP_NUM_TABLES], total = sizeof(bp_predictor) + sizeof(bp_thread_context);
+    if (!config_valid(config)) return 0;
+    table_sizes(config, sizes);
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        total += table_bytes(sizes[t]);
+    }
+    return total;
+}
+
+ /**
+ * Allocates a predictor for the given configuration.
+ * - For bimodal: a 2^M2 table of 2-bit counters initialized to 2 (weakly taken).
+ * - For gshare: a 2^M1 table of 2-bit counters initialized to 2, global history = 0.
+ *   N above M1 (up to BP_HISTORY_MAX) keeps the history in a circular buffer
+ *   folded down to M1 bits.
+ * - For hybrid: chooser (initialized to 1), gshare and bimodal tables.
+ * - For perceptron: 2^P rows of 64 int8 weights initialized to 0, using
+ *   the vector kernels selected by config->isa.
+ * - For tage: a 2^M2 bimodal base table and T tagged components of 2^B
+ *   16-bit entries each, history lengths spread from Lmin to Lmax.
+ * - For local: 2^L H-bit histories packed into a bit array, initialized to 0,
+ *   and 2^(S+H) 2-bit counters initialized to 2.
+ * - For tournament: a 2^K chooser (initialized to 1) plus the tables of its
+ *   two components.
+ * - For loop (or any counter-based type with E set): 2^E packed 64-bit loop
+ *   entries, initialized to 0 (invalid).
+ * Returns NULL if the configuration is invalid or memory is exhausted.
+ */
+
+bp_predictor *bp_create(const bp_config *config) {
+    if (!config_valid(config)) return NULL;
+    bp_predictor *bp = (bp_predictor*)calloc(1, sizeof(bp_predictor));
+    if (!bp) return NULL;
+    bp->config = *config;
+    table_sizes(config, bp->sizes);
+    if (config->type == BP_PERCEPTRON) {
+        if (bp_perceptron_select(config->isa, &bp->perceptron) != 0) {
+            free(bp);
+            return NULL;
+        }
+        bp->perceptron_mask = (1UL << config->P) - 1;
+        bp->perceptron_bias = 1UL << config->H;
+        bp->perceptron_valid = config->H + 1 == BP_PERCEPTRON_ROW ? ~0UL : (1UL << (config->H + 1)) - 1;
+        bp->theta = config->theta ? config->theta : (long int)(1.93 * config->H + 14);
+    }
+    if (config->type == BP_TAGE) {
+        bp_tage_init(&bp->tage, config);
+        if (bp_tage_select(config->isa, &bp->tage) != 0) {
+            free(bp);
+            return NULL;
+        }
+    }
+    if (bp->sizes[BP_TABLE_LOCAL]) {
+        bp->local_mask = (1UL << config->H) - 1;
+        bp->local_entry_mask = (1UL << config->L) - 1;
+        bp->local_set_mask = (1UL << config->S) - 1;
+    }
+    if (config->E) bp->loop_mask = (1UL << config->E) - 1;
+
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (bp->sizes[t] == 0) continue;
+        bp->tables[t] = table_alloc(bp->sizes[t]);
+        if (!bp->tables[t]) {
+            bp_destroy(bp);
+            return NULL;
+        }
+    }
+    bp->thread_count = 1;
+    bp->contexts = (bp_thread_context*)malloc(sizeof(bp_thread_context));
+    if (!bp->contexts) {
+        bp_destroy(bp);
+        return NULL;
+    }
+
+    // A gshare history longer than its index is folded down to M1 bits
+    bp->long_history = bp->sizes[BP_TABLE_GSHARE] && config->N > config->M1;
+    unsigned long gshare_bits = bp->long_history ? config->M1 : config->N;
+    if (bp->long_history) bp->history_out_bit = 1UL << (config->N % config->M1);
+
+    // The perceptron shares the history register machinery with gshare
+    unsigned long history_bits = config->type == BP_PERCEPTRON ? config->H : gshare_bits;
+    bp->history_mask = (1UL << history_bits) - 1;
+    bp->history_top = history_bits ? 1UL << (history_bits - 1) : 0;
+    bp->gshare_shift = config->M1 - gshare_bits;
+    bp->pc_upper_shift = bp->gshare_shift + 2;
+    bp->mlessn_mask = (1UL << bp->gshare_shift) - 1;
+    bp->bimodal_mask = (1UL << config->M2) - 1;
+    bp->chooser_mask = (1UL << config->K) - 1;
+    fill_tables(bp);
+    return bp;
+}
+
+ /**
+ * Gives each of threads hardware threads a private global history, all
+ * empty, with thread 0 running; tables stay shared. bp_switch_thread then
+ * selects whose history the following branches use. Returns 0 on success,
+ * -1 if threads is 0 or memory is exhausted.
+ */
+
+int bp_set_threads(bp_predictor *bp, unsigned int threads) {
+    if (threads == 0) return -1;
+    bp_thread_context *contexts = (bp_thread_context*)malloc(threads * sizeof(bp_thread_context));
+    if (!contexts) return -1;
+    free(bp->contexts);
+    bp->contexts = contexts;
+    bp->thread_count = threads;
+    clear_histories(bp);
+    return 0;
+}
+
+int bp_switch_thread(bp_predictor *bp, unsigned int thread) {
+    if (thread >= bp->thread_count) return -1;
+    bp_switch_thread_inline(bp, thread);
+    return 0;
+}
+
+ /**
+ * Flags the block holding byte offset of table t as written since the last
+ * flush (see bp_flush).
+ */
+
+static void mark_dirty(bp_predictor *bp, bp_table_id t, unsigned long offset) {
+    unsigned long block = offset >> BP_DIRTY_SHIFT;
+    bp->dirty[t][block >> 6] |= 1ULL << (block & 63);
+}
+
+ /**
+ * Flags every entry training on pred may have written: the entry read in each
+ * table, all T components for TAGE (allocation and useful-bit decay touch
+ * those), and both ends of an unaligned local history word.
+ */
+
+void bp_mark_trained(bp_predictor *bp, const bp_prediction *pred) {
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!bp->dirty[t]) continue;
+        unsigned long index = pred->index[t];
+        switch (t) {
+            case BP_TABLE_TAGE:
+                for (unsigned int i = 0; i < bp->tage.tables; i++) mark_dirty(bp, BP_TABLE_TAGE, pred->tage_index[i] * sizeof(uint16_t));
+                break;
+            case BP_TABLE_PERCEPTRON:
+                mark_dirty(bp, BP_TABLE_PERCEPTRON, index * BP_PERCEPTRON_ROW);
+                break;
+            case BP_TABLE_LOCAL_HISTORY:
+                mark_dirty(bp, BP_TABLE_LOCAL_HISTORY, (index * bp->config.H) >> 3);
+                mark_dirty(bp, BP_TABLE_LOCAL_HISTORY, ((index * bp->config.H) >> 3) + sizeof(uint64_t) - 1);
+                break;
+            case BP_TABLE_LOOP:
+                mark_dirty(bp, BP_TABLE_LOOP, index * sizeof(uint64_t));
+                break;
+            default:
+                mark_dirty(bp, (bp_table_id)t, index);
+        }
+    }
+}
+
+ /**
+ * Stores in spans the bytes training on pred may have written, the entries
+ * bp_mark_trained flags, and returns how many there are (at most
+ * BP_MAX_SPANS). Call it right after the training: when that training aged
+ * the TAGE useful counters, the whole TAGE table is reported instead.
+ */
+
+size_t bp_trained_spans(const bp_predictor *bp, const bp_prediction *pred, bp_span *spans) {
+    size_t n = 0;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!bp->tables[t]) continue;
+        unsigned long index = pred->index[t];
+        if (t == BP_TABLE_TAGE) {
+            if (bp->tage.tick == 0) {
+                spans[n++] = (bp_span){ BP_TABLE_TAGE, 0, bp->sizes[t] };
+                continue;
+            }
+            for (unsigned int i = 0; i < bp->tage.tables; i++) {
+                spans[n++] = (bp_span){ BP_TABLE_TAGE, pred->tage_index[i] * sizeof(uint16_t), sizeof(uint16_t) };
+            }
+            continue;
+        }
+        if (t == BP_TABLE_LOCAL_HISTORY) {
+            // bp_local_write rewrites a whole unaligned word
+            spans[n++] = (bp_span){ BP_TABLE_LOCAL_HISTORY, (index * bp->config.H) >> 3, sizeof(uint64_t) };
+            continue;
+        }
+        bp_entry_span(bp, (bp_table_id)t, index, &spans[n++]);
+    }
+    return n;
+}
+
+ /**
+ * Starts tracking which blocks of each table training writes, so bp_flush
+ * costs O(blocks touched since the previous flush) rather than O(table size).
+ * Every block starts out dirty, since earlier training was not tracked.
+ * Returns 0 on success, -1 if memory is exhausted.
+ */
+
+int bp_track_dirty(bp_predictor *bp) {
+    if (bp->track_dirty) return 0;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!bp->tables[t]) continue;
+        size_t bytes = dirty_words(bp->sizes[t]) * sizeof(uint64_t);
+        bp->dirty[t] = (uint64_t*)malloc(bytes);
+        if (!bp->dirty[t]) {
+            for (int i = 0; i < t; i++) {
+                free(bp->dirty[i]);
+                bp->dirty[i] = NULL;
+            }
+            return -1;
+        }
+        memset(bp->dirty[t], 0xff, bytes);
+    }
+    bp->track_dirty = 1;
+    return 0;
+}
+
+ /**
+ * Resets the tables selected by what to their initial values, as on a context
+ * switch that flushes predictor state, and with BP_FLUSH_HISTORY empties the
+ * global history too. Statistics are kept. With dirty tracking only blocks
+ * trained since the last flush are rewritten; otherwise whole tables are.
+ */
+
+void bp_flush(bp_predictor *bp, unsigned int what) {
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!(what & (1u << t)) || !bp->tables[t]) continue;
+        if (t == BP_TABLE_TAGE) {
+            bp->tage.use_alt = 0;
+            bp->tage.tick = 0;
+        }
+        if (!bp->dirty[t]) {
+            memset(bp->tables[t], table_init[t], bp->sizes[t]);
+            continue;
+        }
+        size_t words = dirty_words(bp->sizes[t]);
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = bp->dirty[t][w]; bits; bits &= bits - 1) {
+                size_t offset = (w * 64 + (size_t)__builtin_ctzll(bits)) * BP_DIRTY_BLOCK;
+                if (offset >= bp->sizes[t]) break;
+                size_t length = bp->sizes[t] - offset < BP_DIRTY_BLOCK ? bp->sizes[t] - offset : BP_DIRTY_BLOCK;
+                memset(bp->tables[t] + offset, table_init[t], length);
+            }
+            bp->dirty[t][w] = 0;
+        }
+    }
+    if (what & BP_FLUSH_HISTORY) clear_histories(bp);
+}
+
+ /**
+ * Restores every table to its initial value and clears history and statistics.
+ */
+
+void bp_reset(bp_predictor *bp) {
+    fill_tables(bp);
+}
+
+ /**
+ * Returns an independent deep copy of the predictor, including statistics.
+ */
+
+bp_predictor *bp_snapshot(const bp_predictor *bp) {
+    bp_predictor *copy = (bp_predictor*)malloc(sizeof(bp_predictor));
+    if (!copy) return NULL;
+    *copy = *bp;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        copy->tables[t] = NULL;
+        copy->dirty[t] = NULL;
+    }
+    copy->contexts = (bp_thread_context*)malloc(bp->thread_count * sizeof(bp_thread_context));
+    if (!copy->contexts) {
+        bp_destroy(copy);
+        return NULL;
+    }
+    memcpy(copy->contexts, bp->contexts, bp->thread_count * sizeof(bp_thread_context));
+    copy->history = &copy->contexts[bp->thread].history;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!bp->tables[t]) continue;
+        copy->tables[t] = table_alloc(bp->sizes[t]);
+        if (!copy->tables[t]) {
+            bp_destroy(copy);
+            return NULL;
+        }
+        memcpy(copy->tables[t], bp->tables[t], bp->sizes[t]);
+        if (!bp->dirty[t]) continue;
+        size_t bytes = dirty_words(bp->sizes[t]) * sizeof(uint64_t);
+        copy->dirty[t] = (uint64_t*)malloc(bytes);
+        if (!copy->dirty[t]) {
+            bp_destroy(copy);
+            return NULL;
+        }
+        memcpy(copy->dirty[t], bp->dirty[t], bytes);
+    }
+    return copy;
+}
+
+ /**
+ * Writes the predictor's complete state (configuration, tables, histories of
+ * every thread and statistics) so bp_load can continue from it. The format is
+ * a raw dump for the same build of libbp, checked by a version word and the
+ * sizes of the structures it contains. Returns 0 on success, -1 on an I/O error.
+ */
+
+int bp_save(const bp_predictor *bp, FILE *fp) {
+    uint32_t header[4] = { BP_STATE_MAGIC, BP_STATE_VERSION, (uint32_t)sizeof(bp_config), (uint32_t)sizeof(bp_thread_context) };
+    int ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    ok &= fwrite(&bp->config, sizeof(bp->config), 1, fp) == 1;
+    ok &= fwrite(&bp->stats, sizeof(bp->stats), 1, fp) == 1;
+    ok &= fwrite(&bp->thread_count, sizeof(bp->thread_count), 1, fp) == 1;
+    ok &= fwrite(&bp->thread, sizeof(bp->thread), 1, fp) == 1;
+    ok &= fwrite(&bp->global_history, sizeof(bp->global_history), 1, fp) == 1;
+    ok &= fwrite(bp->contexts, sizeof(bp_thread_context), bp->thread_count, fp) == bp->thread_count;
+    ok &= fwrite(bp->tage.fold, sizeof(bp->tage.fold), 1, fp) == 1;
+    ok &= fwrite(&bp->tage.use_alt, sizeof(bp->tage.use_alt), 1, fp) == 1;
+    ok &= fwrite(&bp->tage.tick, sizeof(bp->tage.tick), 1, fp) == 1;
+    for (int t = 0; t < BP_NUM_TABLES && ok; t++) {
+        uint64_t size = bp->sizes[t];
+        ok &= fwrite(&size, sizeof(size), 1, fp) == 1;
+        if (size) ok &= fwrite(bp->tables[t], size, 1, fp) == 1;
+    }
+    return ok ? 0 : -1;
+}
+
+ /**
+ * Recreates a predictor written by bp_save. Dirty tracking is not part of the
+ * state and starts off. Returns NULL if the data is truncated, comes from a
+ * different libbp build or memory is exhausted.
+ */
+
+bp_predictor *bp_load(FILE *fp) {
+    uint32_t header[4];
+    bp_config config;
+    if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != BP_STATE_MAGIC || header[1] != BP_STATE_VERSION ||
+        header[2] != sizeof(bp_config) || header[3] != sizeof(bp_thread_context)) return NULL;
+    if (fread(&config, sizeof(config), 1, fp) != 1) return NULL;
+    bp_predictor *bp = bp_create(&config);
+    if (!bp) return NULL;
+    unsigned int threads = 0, thread = 0;
+    int ok = fread(&bp->stats, sizeof(bp->stats), 1, fp) == 1;
+    ok &= fread(&threads, sizeof(threads), 1, fp) == 1;
+    ok &= fread(&thread, sizeof(thread), 1, fp) == 1;
+    if (!ok || thread >= threads || (threads > 1 && bp_set_threads(bp, threads) != 0)) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    ok &= fread(&bp->global_history, sizeof(bp->global_history), 1, fp) == 1;
+    ok &= fread(bp->contexts, sizeof(bp_thread_context), threads, fp) == threads;
+    bp->thread = thread;
+    bp->history = &bp->contexts[thread].history;
+    ok &= fread(bp->tage.fold, sizeof(bp->tage.fold), 1, fp) == 1;
+    ok &= fread(&bp->tage.use_alt, sizeof(bp->tage.use_alt), 1, fp) == 1;
+    ok &= fread(&bp->tage.tick, sizeof(bp->tage.tick), 1, fp) == 1;
+    for (int t = 0; t < BP_NUM_TABLES && ok; t++) {
+        uint64_t size;
+        ok &= fread(&size, sizeof(size), 1, fp) == 1 && size == bp->sizes[t];
+        if (ok && size) ok &= fread(bp->tables[t], size, 1, fp) == 1;
+    }
+    if (!ok) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    return bp;
+}
+
+ /**
+ * Frees the predictor and every table it owns.
+ */
+
+void bp_destroy(bp_predictor *bp) {
+    if (!bp) return;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        free(bp->tables[t]);
+        free(bp->dirty[t]);
+    }
+    free(bp->contexts);
+    free(bp);
+}
+
+const bp_config *bp_get_config(const bp_predictor *bp) {
+    return &bp->config;
+}
+
+void bp_get_stats(const bp_predictor *bp, bp_stats *stats) {
+    *stats = bp->stats;
+}
+
+ /**
+ * Returns a read-only view of one prediction table, or NULL if the
+ * predictor type does not use it. Its size in bytes is stored in *size.
+ */
+
+const unsigned char *bp_table(const bp_predictor *bp, bp_table_id id, size_t *size) {
+    if (size) *size = bp->sizes[id];
+    return bp->tables[id];
+}
+
+ /**
+ * Sets *span to the bytes holding entry of table id, numbered as in
+ * bp_print_contents: a counter per byte, a weight vector per perceptron row,
+ * "component << B | slot" for TAGE, an H-bit history per local history
+ * entry and 8 bytes per loop entry.
+ * Returns 0, or -1 if the table is unused or has no such entry.
+ */
+
+int bp_entry_span(const bp_predictor *bp, bp_table_id id, unsigned long int entry, bp_span *span) {
+    unsigned long int count;
+    size_t width = 1;
+    if (!bp->tables[id]) return -1;
+    switch (id) {
+        case BP_TABLE_PERCEPTRON:
+            count = bp->perceptron_mask + 1;
+            width = BP_PERCEPTRON_ROW;
+            break;
+        case BP_TABLE_TAGE:
+            count = (unsigned long int)bp->tage.tables << bp->tage.index_bits;
+            width = sizeof(uint16_t);
+            break;
+        case BP_TABLE_LOCAL_HISTORY:
+            if (entry > bp->local_entry_mask) return -1;
+            span->table = id;
+            span->offset = (entry * bp->config.H) >> 3;
+            span->length = (((entry + 1) * bp->config.H - 1) >> 3) - span->offset + 1;
+            return 0;
+        case BP_TABLE_LOOP:
+            count = bp->loop_mask + 1;
+            width = sizeof(uint64_t);
+            break;
+        default:
+            count = bp->sizes[id];
+    }
+    if (entry >= count) return -1;
+    span->table = id;
+    span->offset = entry * width;
+    span->length = width;
+    return 0;
+}
+
+ /**
+ * Prints one entry of table id (see bp_entry_span) as a line of
+ * bp_print_contents.
+ */
+
+void bp_print_entry(const bp_predictor *bp, bp_table_id id, unsigned long int entry, FILE *out) {
+    if (id == BP_TABLE_PERCEPTRON) {
+        const signed char *weights = (const signed char*)bp->tables[id] + entry * BP_PERCEPTRON_ROW;
+        fprintf(out, "%lu      %d", entry, weights[bp->config.H]);
+        for (unsigned long h = 0; h < bp->config.H; h++) fprintf(out, " %d", weights[h]);
+        fprintf(out, "\n");
+    }
+    else if (id == BP_TABLE_TAGE) {
+        bp_tage_print_entry(&bp->tage, (const uint16_t*)bp->tables[id], entry, out);
+    }
+    else if (id == BP_TABLE_LOOP) {
+        uint64_t e = ((const uint64_t*)bp->tables[id])[entry];
+        fprintf(out, "%lu      %u %u %u %u %u %u %u\n", entry, BP_LOOP_VALID(e), BP_LOOP_TAG(e), BP_LOOP_TRIP(e),
+                BP_LOOP_ITER(e), BP_LOOP_CONF(e), BP_LOOP_AGE(e), BP_LOOP_DIR(e));
+    }
+    else if (id == BP_TABLE_LOCAL_HISTORY) {
+        fprintf(out, "%lu      %lu\n", entry, bp_local_read(bp, entry));
+    }
+    else {
+        fprintf(out, "%lu      %u\n", entry, bp->tables[id][entry]);
+    }
+}
+
+ /**
+ * Prints the final contents of each prediction table.
+ * Output format matches branch prediction project specification.
+ * Perceptron rows are printed as the bias followed by the H history weights,
+ * packed local histories as one value per entry, and loop entries as
+ * "<valid> <tag> <trip> <iteration> <confidence> <age> <direction>".
+ */
+
+void bp_print_contents(const bp_predictor *bp, FILE *out) {
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (!bp->tables[t]) continue;
+        fprintf(out, "FINAL %s CONTENTS\n", table_names[t]);
+        bp_span span;
+        for (unsigned long i = 0; bp_entry_span(bp, (bp_table_id)t, i, &span) == 0; i++) bp_print_entry(bp, (bp_table_id)t, i, out);
+    }
+}
+
+ /**
+ * Overwrites length bytes of table id at offset with data, e.g. to rebuild
+ * a recorded state. Returns 0, or -1 if the range is outside the table.
+ */
+
+int bp_patch(bp_predictor *bp, bp_table_id id, size_t offset, const void *data, size_t length) {
+    if (!bp->tables[id] || offset > bp->sizes[id] || length > bp->sizes[id] - offset) return -1;
+    memcpy(bp->tables[id] + offset, data, length);
+    return 0;
+}
+
+ /**
+ * Simulates one branch with the predictor type fixed at compile time:
+ * a prediction immediately followed by its non-speculative update.
+ */
+
+static inline int step_typed(bp_predictor *bp, bp_type type, unsigned long int addr, int taken) {
+    bp_prediction pred;
+    bp_predict_typed(bp, type, addr, &pred);
+    int correct = bp_train_typed(bp, type, &pred, taken);
+    bp_history_push_typed(bp, type, taken);
+    return correct;
+}
+
+ /**
+ * Same as step_typed for a hybrid or tournament whose component types and
+ * update policy are fixed at compile time.
+ */
+
+static inline int step_tournament(bp_predictor *bp, bp_type first, bp_type second, bp_update_policy policy,
+                                  unsigned long int addr, int taken) {
+    bp_prediction pred;
+    bp_tournament_predict(bp, first, second, addr, &pred);
+    int correct = bp_tournament_train(bp, first, second, policy, &pred, taken);
+    bp_history_push_typed(bp, BP_TOURNAMENT, taken);
+    return correct;
+}
+
+ /**
+ * Same as step_typed for TAGE with the build fixed: the plain C one, or the
+ * SSE2 or the AVX2 one with the number of component groups fixed at compile
+ * time.
+ */
+
+static inline __attribute__((always_inline)) int step_tage(bp_predictor *bp, unsigned long int addr, int taken) {
+    bp_prediction pred;
+    bp_predict_tage(bp, addr, &pred);
+    int correct = bp_tage_train_record(bp, &pred, taken);
+    bp_push_tage(bp, taken);
+    return correct;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline __attribute__((always_inline)) int step_tage_sse2(bp_predictor *bp, unsigned int groups, unsigned long int addr, int taken) {
+    bp_prediction pred;
+    bp_predict_tage_sse2(bp, groups, addr, &pred);
+    int correct = bp_tage_train_record(bp, &pred, taken);
+    bp_push_tage_sse2(bp, groups, taken);
+    return correct;
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) int step_tage_avx2(bp_predictor *bp, unsigned int groups, unsigned long int addr, int taken) {
+    bp_prediction pred;
+    bp_predict_tage_avx2(bp, groups, addr, &pred);
+    int correct = bp_tage_train_record(bp, &pred, taken);
+    bp_push_tage_avx2(bp, groups, taken);
+    return correct;
+}
+
+#endif
+
+ /**
+ * Every ordered pair of tournament components, under every update policy,
+ * gets its own specialized loop; hybrid runs as the gshare/bimodal pair.
+ */
+
+#define TOURNAMENT_PAIRS(X) \
+    X(BP_BIMODAL, BP_GSHARE) \
+    X(BP_BIMODAL, BP_LOCAL) \
+    X(BP_GSHARE, BP_BIMODAL) \
+    X(BP_GSHARE, BP_LOCAL) \
+    X(BP_LOCAL, BP_BIMODAL) \
+    X(BP_LOCAL, BP_GSHARE)
+
+#define POLICIES(X, first, second) \
+    X(first, second, BP_UPDATE_CHOSEN) \
+    X(first, second, BP_UPDATE_BOTH) \
+    X(first, second, BP_UPDATE_DISAGREE)
+
+#define SHAPE(first, second, policy) (((first) * 16 + (second)) * BP_NUM_POLICIES + (policy))
+
+static unsigned int shape_of(const bp_predictor *bp) {
+    if (bp->config.type == BP_HYBRID) return SHAPE(BP_GSHARE, BP_BIMODAL, bp->config.policy);
+    return SHAPE(bp->config.first, bp->config.second, bp->config.policy);
+}
+
+ /**
+ * Software-pipelines the local predictor's dependent loads across a batch:
+ * the history entry of the branch 2*BP_LOCAL_LOOKAHEAD ahead is prefetched,
+ * and the one BP_LOCAL_LOOKAHEAD ahead (already on its way) is read to
+ * prefetch the pattern counter it will select. A history changed in between
+ * only makes the hint stale; results are unaffected.
+ */
+
+static inline void local_prefetch(const bp_predictor *bp, const unsigned long int *addrs, size_t i, size_t count) {
+    if (i + 2 * BP_LOCAL_LOOKAHEAD < count) {
+        unsigned long entry = (addrs[i + 2 * BP_LOCAL_LOOKAHEAD] >> 2) & bp->local_entry_mask;
+        __builtin_prefetch(bp->tables[BP_TABLE_LOCAL_HISTORY] + ((entry * bp->config.H) >> 3));
+    }
+    if (i + BP_LOCAL_LOOKAHEAD < count) {
+        unsigned long addr = addrs[i + BP_LOCAL_LOOKAHEAD];
+        unsigned long history = bp_local_read(bp, (addr >> 2) & bp->local_entry_mask);
+        __builtin_prefetch(bp->tables[BP_TABLE_LOCAL] + bp_local_index(bp, addr, history), 1);
+    }
+}
+
+ /**
+ * Streaming interface for embedding in a pipeline model.
+ * - bp_predict looks a branch up without changing any state.
+ * - bp_update trains the entries read by that prediction and shifts the
+ *   outcome into global history.
+ * - For speculative history, push the predicted direction with
+ *   bp_history_push after a checkpoint, restore the checkpoint on a flush,
+ *   and call bp_train (which leaves history alone) when the branch resolves.
+ */
+
+void bp_predict(const bp_predictor *bp, unsigned long int addr, bp_prediction *pred) {
+    bp_predict_inline(bp, addr, pred);
+}
+
+int bp_update(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    return bp_update_inline(bp, pred, taken != 0);
+}
+
+int bp_train(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    return bp_train_inline(bp, pred, taken != 0);
+}
+
+void bp_history_push(bp_predictor *bp, int taken) {
+    bp_history_push_inline(bp, taken != 0);
+}
+
+void bp_checkpoint_history(const bp_predictor *bp, bp_checkpoint *checkpoint) {
+    bp_checkpoint_inline(bp, checkpoint);
+}
+
+void bp_restore_history(bp_predictor *bp, const bp_checkpoint *checkpoint) {
+    bp_restore_inline(bp, checkpoint);
+}
+
+ /**
+ * Simulates a single branch and records it in the predictor's statistics.
+ * Returns 1 if the prediction was correct, 0 otherwise.
+ */
+
+int bp_step(bp_predictor *bp, unsigned long int addr, int taken) {
+    switch (bp->config.type) {
+        case BP_GSHARE:     return step_typed(bp, BP_GSHARE, addr, taken != 0);
+        case BP_PERCEPTRON: return step_typed(bp, BP_PERCEPTRON, addr, taken != 0);
+        case BP_TAGE:       return step_typed(bp, BP_TAGE, addr, taken != 0);
+        case BP_LOCAL:      return step_typed(bp, BP_LOCAL, addr, taken != 0);
+        case BP_LOOP:       return step_typed(bp, BP_LOOP, addr, taken != 0);
+        case BP_HYBRID:
+        case BP_TOURNAMENT:
+            switch (shape_of(bp)) {
+#define X(first, second, policy) \
+                case SHAPE(first, second, policy): return step_tournament(bp, first, second, policy, addr, taken != 0);
+#define PAIR_POLICIES(first, second) POLICIES(X, first, second)
+                TOURNAMENT_PAIRS(PAIR_POLICIES)
+#undef PAIR_POLICIES
+#undef X
+            }
+            return step_typed(bp, bp->config.type, addr, taken != 0);
+        default:            return step_typed(bp, BP_BIMODAL, addr, taken != 0);
+    }
+}
+
+#define LOG_OUTCOME(log, i, step) \
+    do { int correct_ = (step); if (log) (log)[(i) >> 6] |= (uint64_t)!correct_ << ((i) & 63); } while (0)
+
+#if defined(__x86_64__) || defined(__i386__)
+
+ /**
+ * TAGE batch loops, one per number of component groups in each vector build;
+ * the AVX2 one has to be a function of its own to be compiled for AVX2.
+ */
+
+static void batch_tage_sse2(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count, uint64_t *log) {
+    switch (bp_tage_groups(&bp->tage, BP_TAGE_LANES)) {
+#define X(groups) \
+        case groups: \
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_tage_sse2(bp, groups, addrs[i], taken[i] != 0)); \
+            break;
+        X(1) X(2) X(3) X(4)
+#undef X
+    }
+}
+
+__attribute__((target("avx2")))
+static void batch_tage_avx2(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count, uint64_t *log) {
+    switch (bp_tage_groups(&bp->tage, BP_TAGE_AVX2_LANES)) {
+#define X(groups) \
+        case groups: \
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_tage_avx2(bp, groups, addrs[i], taken[i] != 0)); \
+            break;
+        X(1) X(2)
+#undef X
+    }
+}
+
+#endif
+
+ /**
+ * Batch loop shared by bp_batch and bp_batch_log: the predictor type is
+ * resolved once, outside the per-branch loop. With log NULL (a constant at
+ * both call sites) the outcome bookkeeping compiles away.
+ */
+
+static inline __attribute__((always_inline)) unsigned long int batch(bp_predictor *bp, const unsigned long int *addrs,
+                                                                    const unsigned char *taken, size_t count, uint64_t *log) {
+    unsigned long int before = bp->stats.mispredictions;
+    if (bp->jit && !bp->track_dirty && !log) {
+        unsigned long int mispredictions = bp->jit(bp->tables[BP_TABLE_CHOOSER], bp->tables[BP_TABLE_GSHARE], bp->tables[BP_TABLE_BIMODAL],
+                                                   &bp->global_history, addrs, taken, count);
+        bp->stats.predictions += count;
+        bp->stats.mispredictions += mispredictions;
+        return mispredictions;
+    }
+    if (log) memset(log, 0, (count + 63) / 64 * sizeof(uint64_t));
+    switch (bp->config.type) {
+        case BP_BIMODAL:
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_typed(bp, BP_BIMODAL, addrs[i], taken[i] != 0));
+            break;
+        case BP_GSHARE:
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_typed(bp, BP_GSHARE, addrs[i], taken[i] != 0));
+            break;
+        case BP_PERCEPTRON:
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_typed(bp, BP_PERCEPTRON, addrs[i], taken[i] != 0));
+            break;
+        case BP_TAGE:
+#if defined(__x86_64__) || defined(__i386__)
+            if (bp->tage.build == BP_TAGE_AVX2) {
+                batch_tage_avx2(bp, addrs, taken, count, log);
+                break;
+            }
+            if (bp->tage.build == BP_TAGE_SSE2) {
+                batch_tage_sse2(bp, addrs, taken, count, log);
+                break;
+            }
+#endif
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_tage(bp, addrs[i], taken[i] != 0));
+            break;
+        case BP_LOCAL:
+            for (size_t i = 0; i < count; i++) {
+                local_prefetch(bp, addrs, i, count);
+                LOG_OUTCOME(log, i, step_typed(bp, BP_LOCAL, addrs[i], taken[i] != 0));
+            }
+            break;
+        case BP_LOOP:
+            for (size_t i = 0; i < count; i++) LOG_OUTCOME(log, i, step_typed(bp, BP_LOOP, addrs[i], taken[i] != 0));
+            break;
+        case BP_HYBRID:
+        case BP_TOURNAMENT:
+            switch (shape_of(bp)) {
+#define X(first, second, policy) \
+                case SHAPE(first, second, policy): \
+                    for (size_t i = 0; i < count; i++) { \
+                        if (first == BP_LOCAL || second == BP_LOCAL) local_prefetch(bp, addrs, i, count); \
+                        LOG_OUTCOME(log, i, step_tournament(bp, first, second, policy, addrs[i], taken[i] != 0)); \
+                    } \
+                    break;
+#define PAIR_POLICIES(first, second) POLICIES(X, first, second)
+                TOURNAMENT_PAIRS(PAIR_POLICIES)
+#undef PAIR_POLICIES
+#undef X
+            }
+            break;
+    }
+    return bp->stats.mispredictions - before;
+}
+
+ /**
+ * Simulates count branches from parallel address/outcome arrays, through
+ * the kernel specialized by bp_jit if there is one.
+ * Returns the number of mispredictions within this batch.
+ */
+
+unsigned long int bp_batch(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count) {
+    return batch(bp, addrs, taken, count, NULL);
+}
+
+ /**
+ * Same as bp_batch, also recording which branches mispredicted: bit i % 64
+ * of mispredicted[i / 64] is set if branch i was mispredicted. The array
+ * must hold (count + 63) / 64 words; it is cleared first.
+ */
+
+unsigned long int bp_batch_log(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count,
+                               uint64_t *mispredicted) {
+    return batch(bp, addrs, taken, count, mispredicted);
+}
@@ -0,0 +1,199 @@
+#ifndef BP_H
+#define BP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+ /**
+ * libbp: bimodal, gshare, hybrid, perceptron, TAGE, local-history and loop
+ * branch predictors, and tournaments of any two counter-based ones, behind an
+ * opaque handle.
+ * All state lives in the handle, so independent handles can be driven from
+ * different threads concurrently without locking.
+ */
+
+typedef enum bp_type{
+    BP_BIMODAL,
+    BP_GSHARE,
+    BP_HYBRID,
+    BP_PERCEPTRON,
+    BP_TAGE,
+    BP_LOCAL,
+    BP_TOURNAMENT,
+    BP_LOOP
+}bp_type;
+
+typedef enum bp_table_id{
+    BP_TABLE_CHOOSER,
+    BP_TABLE_GSHARE,
+    BP_TABLE_BIMODAL,
+    BP_TABLE_PERCEPTRON,
+    BP_TABLE_TAGE,
+    BP_TABLE_LOCAL_HISTORY,
+    BP_TABLE_LOCAL,
+    BP_TABLE_LOOP,
+    BP_NUM_TABLES
+}bp_table_id;
+
+ /**
+ * Instruction set used by the SIMD kernels. BP_ISA_AUTO picks the best one
+ * the CPU supports; the others force a variant, e.g. to compare a vector
+ * kernel against the scalar reference.
+ */
+
+typedef enum bp_isa{
+    BP_ISA_AUTO,
+    BP_ISA_SCALAR,
+    BP_ISA_AVX2,
+    BP_ISA_SSE42,
+    BP_ISA_AVX512,
+    BP_NUM_ISAS
+}bp_isa;
+
+ /**
+ * Which components of a hybrid or tournament are trained after a branch:
+ * - BP_UPDATE_CHOSEN: only the one the chooser selected (the classic scheme).
+ * - BP_UPDATE_BOTH: both of them.
+ * - BP_UPDATE_DISAGREE: both of them, but only when their predictions differed.
+ */
+
+typedef enum bp_update_policy{
+    BP_UPDATE_CHOSEN,
+    BP_UPDATE_BOTH,
+    BP_UPDATE_DISAGREE,
+    BP_NUM_POLICIES
+}bp_update_policy;
+
+typedef struct bp_config{
+    bp_type           type;
+    unsigned long int K;
+    unsigned long int M1;
+    unsigned long int M2;
+    unsigned long int N;
+    unsigned long int P;      /* perceptron: log2 of the number of weight vectors */
+    unsigned long int H;      /* perceptron: global history length, local: bits per history */
+    long int          theta;  /* perceptron: training threshold, 0 for 1.93*H+14 */
+    unsigned long int T;      /* tage: number of tagged components */
+    unsigned long int B;      /* tage: log2 of the entries per tagged component */
+    unsigned long int Lmin;   /* tage: history length of the shortest component */
+    unsigned long int Lmax;   /* tage: history length of the longest component */
+    unsigned long int L;      /* local: log2 of the per-PC history table entries */
+    unsigned long int S;      /* local: log2 of the pattern table sets selected by PC (0 = PAg) */
+    bp_type           first;  /* tournament: component picked when the chooser is >= 2 */
+    bp_type           second; /* tournament: component picked otherwise */
+    bp_update_policy  policy; /* hybrid, tournament: which components train */
+    unsigned long int E;      /* loop: log2 of the loop table entries; on bimodal, gshare, local,
+                                 hybrid and tournament a non-zero E adds the loop override */
+    bp_isa            isa;
+}bp_config;
+
+typedef struct bp_stats{
+    unsigned long int predictions;
+    unsigned long int mispredictions;
+}bp_stats;
+
+typedef struct bp_predictor bp_predictor;
+
+#define BP_TAGE_MAX_TABLES 16     /* most tagged components a TAGE predictor may have */
+
+ /**
+ * Result of bp_predict. The indices and counter values read at prediction
+ * time are kept so the matching bp_update/bp_train trains exactly those
+ * entries, even if global history has moved on in between. A confident loop
+ * entry overrides taken but leaves provider naming the base table.
+ */
+
+typedef struct bp_prediction{
+    int               taken;                    /* final predicted direction */
+    int               confidence;               /* 1 if the deciding counter is saturated
+                                                   (perceptron: |output| above theta) */
+    bp_table_id       provider;                 /* table whose counter decided */
+    unsigned long int index[BP_NUM_TABLES];     /* entry read in each table used */
+    unsigned char     counter[BP_NUM_TABLES];   /* counter value read from each table */
+    long int          output;                   /* perceptron dot product */
+    unsigned long int history;                  /* perceptron or local history it was computed from */
+    int               tage_provider;            /* longest matching component, -1 for base */
+    int               tage_provider_taken;
+    int               tage_alt_taken;
+    unsigned int      tage_index[BP_TAGE_MAX_TABLES];
+    unsigned short    tage_tag[BP_TAGE_MAX_TABLES];
+    int               base_taken;               /* direction before any loop override */
+    unsigned int      loop_tag;
+}bp_prediction;
+
+ /**
+ * Saved speculative history. For TAGE and long gshare histories this includes
+ * the circular buffer position and folded registers; the buffer itself keeps
+ * enough old bits to roll back.
+ */
+
+typedef struct bp_checkpoint{
+    unsigned long int global_history;
+    unsigned int      position;
+    unsigned int      folded[3 * BP_TAGE_MAX_TABLES];
+}bp_checkpoint;
+
+ /**
+ * A range of bytes in one table (see bp_entry_span and bp_trained_spans).
+ */
+
+typedef struct bp_span{
+    bp_table_id       table;
+    size_t            offset;
+    size_t            length;
+}bp_span;
+
+#define BP_MAX_SPANS (BP_NUM_TABLES + BP_TAGE_MAX_TABLES)
+
+ /**
+ * What bp_flush resets: any of (1u << table id), or BP_FLUSH_TABLES for
+ * every table, plus BP_FLUSH_HISTORY for the global history of all threads.
+ */
+
+#define BP_FLUSH_TABLES  ((1u << BP_NUM_TABLES) - 1)
+#define BP_FLUSH_HISTORY (1u << BP_NUM_TABLES)
+
+int bp_type_from_name(const char *name, bp_type *type);
+const char *bp_type_name(bp_type type);
+const char *bp_table_name(bp_table_id id);
+int bp_policy_from_name(const char *name, bp_update_policy *policy);
+const char *bp_policy_name(bp_update_policy policy);
+int bp_isa_from_name(const char *name, bp_isa *isa);
+const char *bp_isa_name(bp_isa isa);
+int bp_isa_supported(bp_isa isa);
+bp_isa bp_isa_best(void);
+
+bp_predictor *bp_create(const bp_config *config);
+size_t bp_footprint(const bp_config *config);
+int bp_step(bp_predictor *bp, unsigned long int addr, int taken);
+unsigned long int bp_batch(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count);
+unsigned long int bp_batch_log(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count,
+                               uint64_t *mispredicted);
+void bp_predict(const bp_predictor *bp, unsigned long int addr, bp_prediction *pred);
+int bp_update(bp_predictor *bp, const bp_prediction *pred, int taken);
+int bp_train(bp_predictor *bp, const bp_prediction *pred, int taken);
+void bp_history_push(bp_predictor *bp, int taken);
+void bp_checkpoint_history(const bp_predictor *bp, bp_checkpoint *checkpoint);
+void bp_restore_history(bp_predictor *bp, const bp_checkpoint *checkpoint);
+int bp_set_threads(bp_predictor *bp, unsigned int threads);
+int bp_switch_thread(bp_predictor *bp, unsigned int thread);
+int bp_track_dirty(bp_predictor *bp);
+size_t bp_trained_spans(const bp_predictor *bp, const bp_prediction *pred, bp_span *spans);
+void bp_flush(bp_predictor *bp, unsigned int what);
+int bp_jit(bp_predictor *bp, const char *dir);
+void bp_reset(bp_predictor *bp);
+bp_predictor *bp_snapshot(const bp_predictor *bp);
+int bp_save(const bp_predictor *bp, FILE *fp);
+bp_predictor *bp_load(FILE *fp);
+void bp_destroy(bp_predictor *bp);
+
+const bp_config *bp_get_config(const bp_predictor *bp);
+void bp_get_stats(const bp_predictor *bp, bp_stats *stats);
+const unsigned char *bp_table(const bp_predictor *bp, bp_table_id id, size_t *size);
+int bp_entry_span(const bp_predictor *bp, bp_table_id id, unsigned long int entry, bp_span *span);
+void bp_print_entry(const bp_predictor *bp, bp_table_id id, unsigned long int entry, FILE *out);
+void bp_print_contents(const bp_predictor *bp, FILE *out);
+int bp_patch(bp_predictor *bp, bp_table_id id, size_t offset, const void *data, size_t length);
+
+#endif
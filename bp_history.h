@@ -0,0 +1,51 @@
+#ifndef BP_HISTORY_H
+#define BP_HISTORY_H
+
+ /**
+ * Long global history (internal to libbp): a circular buffer of outcome bits
+ * plus folded registers that compress a window of it.
+ * - The buffer holds one outcome per byte, newest at pos, so the bit leaving
+ *   a window of length L is a single load at pos + L.
+ * - A folded register keeps the XOR of an L-bit window cut into width-bit
+ *   chunks. Each push rotates it by one, XORs the new bit in at the bottom
+ *   and the departing bit out where it lands (L mod width), costing the same
+ *   few operations whatever L is.
+ * The buffer is about twice BP_HISTORY_MAX so speculative pushes can be
+ * rolled back by restoring pos and the folds.
+ */
+
+#define BP_HISTORY_MAX    2000
+#define BP_HISTORY_BUFFER 4096
+
+typedef struct bp_history{
+    unsigned int  pos;                          /* slot of the newest bit */
+    unsigned char bits[BP_HISTORY_BUFFER];
+}bp_history;
+
+static inline void bp_history_shift(bp_history *history, int taken) {
+    history->pos = (history->pos - 1) & (BP_HISTORY_BUFFER - 1);
+    history->bits[history->pos] = (unsigned char)taken;
+}
+
+ /**
+ * Outcome age branches back (0 is the newest). Called right after a shift
+ * with age L, it is the bit that just left an L-long window.
+ */
+
+static inline unsigned int bp_history_bit(const bp_history *history, unsigned int age) {
+    return history->bits[(history->pos + age) & (BP_HISTORY_BUFFER - 1)];
+}
+
+ /**
+ * Advances a width-bit folded register by one outcome. out_mask is the
+ * register's out bit (1 << (L mod width)) if the departing bit was set, else 0.
+ */
+
+static inline unsigned int bp_fold_update(unsigned int fold, unsigned int width, int taken, unsigned int out_mask) {
+    unsigned int v = (fold << 1) | (unsigned int)taken;
+    v ^= out_mask;
+    v ^= v >> width;
+    return v & ((1u << width) - 1);
+}
+
+#endif
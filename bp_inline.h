@@ -0,0 +1,489 @@
+#ifndef BP_INLINE_H
+#define BP_INLINE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "bp.h"
+#include "bp_history.h"
+#include "bp_perceptron.h"
+#include "bp_tage.h"
+#include "bp_loop.h"
+
+#define BP_DIRTY_SHIFT 9
+#define BP_DIRTY_BLOCK (1UL << BP_DIRTY_SHIFT)
+
+ /**
+ * Inline hot-path variants of bp_predict/bp_train/bp_update for embedding
+ * libbp in cycle-level simulators. Including this header exposes the layout
+ * of bp_predictor; callers must still treat every field as private and only
+ * go through the functions below. The exported functions in bp.c are thin
+ * wrappers around these, so both paths behave identically.
+ */
+
+ /**
+ * Global history of one hardware thread when threads keep private histories
+ * (see bp_set_threads): its buffer plus the registers saved while another
+ * thread runs.
+ */
+
+typedef struct bp_thread_context{
+    bp_checkpoint     checkpoint;
+    bp_history        history;
+}bp_thread_context;
+
+ /**
+ * Batch loop compiled at run time for one exact configuration (see
+ * bp_jit.c). Returns the mispredictions among the count branches.
+ */
+
+typedef unsigned long int (*bp_jit_fn)(unsigned char *chooser, unsigned char *gshare, unsigned char *bimodal,
+                                       unsigned long int *history, const unsigned long int *addrs,
+                                       const unsigned char *taken, size_t count);
+
+struct bp_predictor{
+    bp_config         config;
+    unsigned char     *tables[BP_NUM_TABLES];
+    size_t            sizes[BP_NUM_TABLES];
+    unsigned long int global_history;
+    unsigned long int history_mask;
+    unsigned long int history_top;
+    unsigned long int pc_upper_shift;
+    unsigned long int gshare_shift;
+    unsigned long int mlessn_mask;
+    unsigned long int bimodal_mask;
+    unsigned long int chooser_mask;
+    unsigned long int perceptron_mask;
+    unsigned long int perceptron_bias;
+    unsigned long int perceptron_valid;
+    long int          theta;
+    unsigned long int local_mask;
+    unsigned long int local_entry_mask;
+    unsigned long int local_set_mask;
+    unsigned long int loop_mask;
+    int               long_history;     /* gshare history longer than M1, kept folded */
+    unsigned long int history_out_bit;
+    bp_history        *history;         /* buffer of the running thread */
+    bp_thread_context *contexts;
+    unsigned int      thread_count;
+    unsigned int      thread;
+    uint64_t          *dirty[BP_NUM_TABLES];    /* per table, a bit per BP_DIRTY_BLOCK bytes trained since
+                                                   the last flush; NULL unless bp_track_dirty was called */
+    int               track_dirty;
+    bp_jit_fn         jit;              /* specialized bp_batch loop, NULL for the generic one */
+    bp_perceptron_kernels perceptron;
+    bp_tage           tage;
+    bp_stats          stats;
+};
+
+ /**
+ * Moves a 2-bit saturating counter towards the actual outcome if enable is 1.
+ * Written without branches since outcomes are hard to predict by nature.
+ */
+
+static inline void bp_counter_update_if(unsigned char *counter, int taken, int enable) {
+    unsigned char c = *counter;
+    *counter = c + (enable & taken & (c < 3)) - (enable & !taken & (c > 0));
+}
+
+static inline void bp_counter_update(unsigned char *counter, int taken) {
+    bp_counter_update_if(counter, taken, 1);
+}
+
+ /**
+ * Combines N bits of global history with the upper N of the M1 PC bits via XOR,
+ * keeping the lower M1-N PC bits as they are. A history longer than M1 is
+ * already folded down to M1 bits, so it covers the whole index.
+ */
+
+static inline unsigned long bp_gshare_index(const bp_predictor *bp, unsigned long int addr) {
+    unsigned long pc_upper_n = (addr >> bp->pc_upper_shift) & bp->history_mask;
+    unsigned long xor_result = pc_upper_n ^ bp->global_history;
+    unsigned long mlessn_bits = (addr >> 2) & bp->mlessn_mask;
+    return (xor_result << bp->gshare_shift) | mlessn_bits;
+}
+
+ /**
+ * Local histories are packed back to back, H bits each, in the history table.
+ * One unaligned 8-byte access always covers an entry (H <= 24 plus at most 7
+ * bits of offset), and the table carries 8 bytes of tail padding for it.
+ */
+
+static inline unsigned long bp_local_read(const bp_predictor *bp, unsigned long int entry) {
+    unsigned long bit = entry * bp->config.H;
+    uint64_t word;
+    memcpy(&word, bp->tables[BP_TABLE_LOCAL_HISTORY] + (bit >> 3), sizeof(word));
+    return (word >> (bit & 7)) & bp->local_mask;
+}
+
+static inline void bp_local_write(bp_predictor *bp, unsigned long int entry, unsigned long int history) {
+    unsigned long bit = entry * bp->config.H;
+    unsigned char *at = bp->tables[BP_TABLE_LOCAL_HISTORY] + (bit >> 3);
+    uint64_t word;
+    memcpy(&word, at, sizeof(word));
+    word = (word & ~((uint64_t)bp->local_mask << (bit & 7))) | ((uint64_t)history << (bit & 7));
+    memcpy(at, &word, sizeof(word));
+}
+
+ /**
+ * Second-level pattern table index: the PC selects one of 2^S sets (PAp, or a
+ * single shared set for PAg) and the local history picks the counter in it.
+ */
+
+static inline unsigned long bp_local_index(const bp_predictor *bp, unsigned long int addr, unsigned long int history) {
+    return (((addr >> 2) & bp->local_set_mask) << bp->config.H) | history;
+}
+
+ /**
+ * Table holding the 2-bit counters of a counter-based component
+ * (bimodal, gshare or local), as used inside a tournament.
+ */
+
+static inline bp_table_id bp_component_table(bp_type type) {
+    switch (type) {
+        case BP_GSHARE: return BP_TABLE_GSHARE;
+        case BP_LOCAL:  return BP_TABLE_LOCAL;
+        default:        return BP_TABLE_BIMODAL;
+    }
+}
+
+ /**
+ * Reads the counter a counter-based component selects for addr and returns
+ * the table it came from.
+ */
+
+static inline bp_table_id bp_component_predict(const bp_predictor *bp, bp_type type, unsigned long int addr, bp_prediction *pred) {
+    switch (type) {
+        case BP_GSHARE:
+            pred->index[BP_TABLE_GSHARE] = bp_gshare_index(bp, addr);
+            pred->counter[BP_TABLE_GSHARE] = bp->tables[BP_TABLE_GSHARE][pred->index[BP_TABLE_GSHARE]];
+            return BP_TABLE_GSHARE;
+        case BP_LOCAL:
+            pred->index[BP_TABLE_LOCAL_HISTORY] = (addr >> 2) & bp->local_entry_mask;
+            pred->history = bp_local_read(bp, pred->index[BP_TABLE_LOCAL_HISTORY]);
+            pred->index[BP_TABLE_LOCAL] = bp_local_index(bp, addr, pred->history);
+            pred->counter[BP_TABLE_LOCAL] = bp->tables[BP_TABLE_LOCAL][pred->index[BP_TABLE_LOCAL]];
+            return BP_TABLE_LOCAL;
+        default:
+            pred->index[BP_TABLE_BIMODAL] = (addr >> 2) & bp->bimodal_mask;
+            pred->counter[BP_TABLE_BIMODAL] = bp->tables[BP_TABLE_BIMODAL][pred->index[BP_TABLE_BIMODAL]];
+            return BP_TABLE_BIMODAL;
+    }
+}
+
+static inline void bp_counter_decide(bp_prediction *pred) {
+    unsigned char counter = pred->counter[pred->provider];
+    pred->taken = counter >= 2;
+    pred->confidence = counter == 0 || counter == 3;
+}
+
+ /**
+ * Lets a confident loop entry override the prediction made so far, if this
+ * predictor has a loop table. The loop fields of pred are filled in either
+ * way, so training never depends on re-checking the table.
+ */
+
+static inline void bp_loop_override(const bp_predictor *bp, unsigned long int addr, bp_prediction *pred) {
+    unsigned long pc = addr >> 2;
+    pred->index[BP_TABLE_LOOP] = pc & bp->loop_mask;
+    pred->loop_tag = (unsigned int)(pc >> bp->config.E) & BP_LOOP_TAG_MASK;
+    pred->base_taken = pred->taken;
+    if (!bp->tables[BP_TABLE_LOOP]) return;
+    uint64_t e = ((const uint64_t*)bp->tables[BP_TABLE_LOOP])[pred->index[BP_TABLE_LOOP]];
+    int confident = bp_loop_confident(e, pred->loop_tag);
+    pred->taken = confident ? bp_loop_taken(e) : pred->taken;
+    pred->confidence |= confident;
+}
+
+ /**
+ * Looks both components up and lets the chooser counter pick one (>= 2 selects
+ * first). With constant component types everything but the two lookups folds
+ * away; hybrid is the gshare/bimodal instance.
+ */
+
+static inline void bp_tournament_predict(const bp_predictor *bp, bp_type first, bp_type second, unsigned long int addr, bp_prediction *pred) {
+    bp_table_id a = bp_component_predict(bp, first, addr, pred);
+    bp_table_id b = bp_component_predict(bp, second, addr, pred);
+    pred->index[BP_TABLE_CHOOSER] = (addr >> 2) & bp->chooser_mask;
+    pred->counter[BP_TABLE_CHOOSER] = bp->tables[BP_TABLE_CHOOSER][pred->index[BP_TABLE_CHOOSER]];
+    pred->provider = pred->counter[BP_TABLE_CHOOSER] >= 2 ? a : b;
+    bp_counter_decide(pred);
+    bp_loop_override(bp, addr, pred);
+}
+
+ /**
+ * TAGE lookup over the bimodal base, in the plain C build or in groups of
+ * the SSE2 or the AVX2 build (see bp_tage.h).
+ */
+
+static inline __attribute__((always_inline)) void bp_predict_tage(const bp_predictor *bp, unsigned long int addr, bp_prediction *pred) {
+    pred->index[BP_TABLE_BIMODAL] = (addr >> 2) & bp->bimodal_mask;
+    pred->counter[BP_TABLE_BIMODAL] = bp->tables[BP_TABLE_BIMODAL][pred->index[BP_TABLE_BIMODAL]];
+    bp_tage_predict(&bp->tage, (const uint16_t*)bp->tables[BP_TABLE_TAGE], pred->counter[BP_TABLE_BIMODAL], addr, pred);
+    pred->provider = pred->tage_provider < 0 ? BP_TABLE_BIMODAL : BP_TABLE_TAGE;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline __attribute__((always_inline)) void bp_predict_tage_sse2(const bp_predictor *bp, unsigned int groups, unsigned long int addr, bp_prediction *pred) {
+    pred->index[BP_TABLE_BIMODAL] = (addr >> 2) & bp->bimodal_mask;
+    pred->counter[BP_TABLE_BIMODAL] = bp->tables[BP_TABLE_BIMODAL][pred->index[BP_TABLE_BIMODAL]];
+    bp_tage_predict_sse2(&bp->tage, groups, (const uint16_t*)bp->tables[BP_TABLE_TAGE], pred->counter[BP_TABLE_BIMODAL], addr, pred);
+    pred->provider = pred->tage_provider < 0 ? BP_TABLE_BIMODAL : BP_TABLE_TAGE;
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void bp_predict_tage_avx2(const bp_predictor *bp, unsigned int groups, unsigned long int addr, bp_prediction *pred) {
+    pred->index[BP_TABLE_BIMODAL] = (addr >> 2) & bp->bimodal_mask;
+    pred->counter[BP_TABLE_BIMODAL] = bp->tables[BP_TABLE_BIMODAL][pred->index[BP_TABLE_BIMODAL]];
+    bp_tage_predict_avx2(&bp->tage, groups, (const uint16_t*)bp->tables[BP_TABLE_TAGE], pred->counter[BP_TABLE_BIMODAL], addr, pred);
+    pred->provider = pred->tage_provider < 0 ? BP_TABLE_BIMODAL : BP_TABLE_TAGE;
+}
+
+#endif
+
+ /**
+ * Looks up a branch without modifying any state. With a constant type the
+ * switch folds away, which is how bp.c builds its per-type batch loops.
+ * - Bimodal and gshare: the counter of their single table decides.
+ * - Local: the PC's own history selects a pattern table counter.
+ * - Hybrid and tournament: a chooser counter picks one of two components.
+ * - Perceptron: the sign of the PC's weight vector dotted with global history.
+ * - TAGE: the longest-history tagged match, with the bimodal table as base.
+ * - Loop: a confident loop entry, predicting taken otherwise.
+ * The counter-based types then go through the optional loop override.
+ */
+
+static inline void bp_predict_typed(const bp_predictor *bp, bp_type type, unsigned long int addr, bp_prediction *pred) {
+    switch (type) {
+        default:
+        case BP_BIMODAL:
+        case BP_GSHARE:
+        case BP_LOCAL:
+            pred->provider = bp_component_predict(bp, type, addr, pred);
+            break;
+        case BP_HYBRID:
+            bp_tournament_predict(bp, BP_GSHARE, BP_BIMODAL, addr, pred);
+            return;
+        case BP_TOURNAMENT:
+            bp_tournament_predict(bp, bp->config.first, bp->config.second, addr, pred);
+            return;
+        case BP_PERCEPTRON:
+            pred->index[BP_TABLE_PERCEPTRON] = (addr >> 2) & bp->perceptron_mask;
+            pred->history = bp->global_history;
+            pred->output = bp->perceptron.dot((const signed char*)bp->tables[BP_TABLE_PERCEPTRON] + pred->index[BP_TABLE_PERCEPTRON] * BP_PERCEPTRON_ROW,
+                                              pred->history | bp->perceptron_bias, bp->perceptron_valid);
+            pred->provider = BP_TABLE_PERCEPTRON;
+            pred->taken = pred->output >= 0;
+            pred->confidence = labs(pred->output) > bp->theta;
+            return;
+        case BP_TAGE:
+#if defined(__x86_64__) || defined(__i386__)
+            if (bp->tage.build != BP_TAGE_SCALAR) {
+                bp_predict_tage_sse2(bp, bp_tage_groups(&bp->tage, BP_TAGE_LANES), addr, pred);
+                return;
+            }
+#endif
+            bp_predict_tage(bp, addr, pred);
+            return;
+        case BP_LOOP:
+            pred->provider = BP_TABLE_LOOP;
+            pred->taken = 1;
+            pred->confidence = 0;
+            bp_loop_override(bp, addr, pred);
+            return;
+    }
+    bp_counter_decide(pred);
+    bp_loop_override(bp, addr, pred);
+}
+
+static inline void bp_local_shift(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    unsigned long entry = pred->index[BP_TABLE_LOCAL_HISTORY];
+    bp_local_write(bp, entry, ((bp_local_read(bp, entry) << 1) | (unsigned long)taken) & bp->local_mask);
+}
+
+ /**
+ * Flags the table blocks training on pred may have written (see bp_flush).
+ * Defined out of line so the untracked hot path only pays for the flag test.
+ */
+
+void bp_mark_trained(bp_predictor *bp, const bp_prediction *pred);
+
+ /**
+ * Common tail of every training path: steps the loop entry read by pred (if
+ * there is a loop table), flags what was trained when dirty tracking is on,
+ * and records the outcome in the statistics.
+ */
+
+static inline int bp_record(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    if (bp->tables[BP_TABLE_LOOP]) {
+        uint64_t *e = &((uint64_t*)bp->tables[BP_TABLE_LOOP])[pred->index[BP_TABLE_LOOP]];
+        *e = bp_loop_update(*e, pred->loop_tag, taken, pred->base_taken != taken);
+    }
+    if (__builtin_expect(bp->track_dirty, 0)) bp_mark_trained(bp, pred);
+    int correct = pred->taken == taken;
+    bp->stats.predictions++;
+    bp->stats.mispredictions += !correct;
+    return correct;
+}
+
+ /**
+ * Trains the TAGE components, or the bimodal base when none matched, and
+ * records the outcome.
+ */
+
+static inline __attribute__((always_inline)) int bp_tage_train_record(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    if (bp_tage_train(&bp->tage, (uint16_t*)bp->tables[BP_TABLE_TAGE], pred, taken)) {
+        bp_counter_update(&bp->tables[BP_TABLE_BIMODAL][pred->index[BP_TABLE_BIMODAL]], taken);
+    }
+    return bp_record(bp, pred, taken);
+}
+
+ /**
+ * Trains a tournament: the component counters move as the update policy says
+ * (a constant policy selects one code path at compile time), a local
+ * component always records the outcome in its history, and the chooser
+ * steps towards whichever component was right when exactly one was.
+ */
+
+static inline int bp_tournament_train(bp_predictor *bp, bp_type first, bp_type second, bp_update_policy policy,
+                                      const bp_prediction *pred, int taken) {
+    bp_table_id a = bp_component_table(first), b = bp_component_table(second);
+    if (policy == BP_UPDATE_CHOSEN) {
+        bp_counter_update(&bp->tables[pred->provider][pred->index[pred->provider]], taken);
+    } else {
+        int enable = policy == BP_UPDATE_BOTH || ((pred->counter[a] >= 2) != (pred->counter[b] >= 2));
+        bp_counter_update_if(&bp->tables[a][pred->index[a]], taken, enable);
+        bp_counter_update_if(&bp->tables[b][pred->index[b]], taken, enable);
+    }
+    if (first == BP_LOCAL || second == BP_LOCAL) bp_local_shift(bp, pred, taken);
+    int first_correct = (pred->counter[a] >= 2) == taken;
+    int second_correct = (pred->counter[b] >= 2) == taken;
+    unsigned char *chooser = &bp->tables[BP_TABLE_CHOOSER][pred->index[BP_TABLE_CHOOSER]];
+    int disagree = first_correct != second_correct;
+    *chooser += (disagree & first_correct & (*chooser < 3)) - (disagree & second_correct & (*chooser > 0));
+    return bp_record(bp, pred, taken);
+}
+
+ /**
+ * Trains the tables read by pred with the resolved outcome and records it in
+ * the statistics. Global history is not touched, so this can run at retire
+ * time after the history was already pushed speculatively. A perceptron is
+ * trained only on a misprediction or when its output was within theta. A local
+ * predictor shifts the outcome into the branch's own history here, since that
+ * history is per PC rather than speculative global state.
+ * Returns 1 if pred was correct, 0 otherwise.
+ */
+
+static inline int bp_train_typed(bp_predictor *bp, bp_type type, const bp_prediction *pred, int taken) {
+    if (type == BP_HYBRID) return bp_tournament_train(bp, BP_GSHARE, BP_BIMODAL, bp->config.policy, pred, taken);
+    if (type == BP_TOURNAMENT) return bp_tournament_train(bp, bp->config.first, bp->config.second, bp->config.policy, pred, taken);
+    if (type == BP_TAGE) return bp_tage_train_record(bp, pred, taken);
+    if (type == BP_PERCEPTRON) {
+        if (pred->taken != taken || labs(pred->output) <= bp->theta) {
+            bp->perceptron.train((signed char*)bp->tables[BP_TABLE_PERCEPTRON] + pred->index[BP_TABLE_PERCEPTRON] * BP_PERCEPTRON_ROW,
+                                 pred->history | bp->perceptron_bias, bp->perceptron_valid, taken);
+        }
+    } else if (type != BP_LOOP) {
+        bp_counter_update(&bp->tables[pred->provider][pred->index[pred->provider]], taken);
+    }
+    if (type == BP_LOCAL) bp_local_shift(bp, pred, taken);
+    return bp_record(bp, pred, taken);
+}
+
+ /**
+ * Shifts an outcome into the TAGE history and moves the folded registers on,
+ * in the plain C build or in groups of the SSE2 or the AVX2 build.
+ */
+
+static inline __attribute__((always_inline)) void bp_push_tage(bp_predictor *bp, int taken) {
+    bp_history_shift(bp->history, taken);
+    bp_tage_push(&bp->tage, bp->history, taken);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline __attribute__((always_inline)) void bp_push_tage_sse2(bp_predictor *bp, unsigned int groups, int taken) {
+    bp_history_shift(bp->history, taken);
+    bp_tage_push_sse2(&bp->tage, groups, bp->history, taken);
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void bp_push_tage_avx2(bp_predictor *bp, unsigned int groups, int taken) {
+    bp_history_shift(bp->history, taken);
+    bp_tage_push_avx2(&bp->tage, groups, bp->history, taken);
+}
+
+#endif
+
+ /**
+ * Shifts an outcome into the global history register (a no-op for bimodal,
+ * whose history width is zero). TAGE and long gshare histories go into the
+ * circular buffer instead, and their folded registers move on with it.
+ */
+
+static inline void bp_history_push_typed(bp_predictor *bp, bp_type type, int taken) {
+    int gshare = type == BP_GSHARE || type == BP_HYBRID || type == BP_TOURNAMENT;
+    if (type == BP_TAGE) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (bp->tage.build != BP_TAGE_SCALAR) {
+            bp_push_tage_sse2(bp, bp_tage_groups(&bp->tage, BP_TAGE_LANES), taken);
+            return;
+        }
+#endif
+        bp_push_tage(bp, taken);
+    } else if (gshare && bp->long_history) {
+        bp_history_shift(bp->history, taken);
+        unsigned int out = 0u - bp_history_bit(bp->history, (unsigned int)bp->config.N);
+        bp->global_history = bp_fold_update((unsigned int)bp->global_history, (unsigned int)bp->config.M1, taken,
+                                            out & (unsigned int)bp->history_out_bit);
+    } else {
+        bp->global_history = ((taken ? bp->history_top : 0) | (bp->global_history >> 1)) & bp->history_mask;
+    }
+}
+
+static inline void bp_history_push_inline(bp_predictor *bp, int taken) {
+    bp_history_push_typed(bp, bp->config.type, taken);
+}
+
+static inline void bp_checkpoint_inline(const bp_predictor *bp, bp_checkpoint *checkpoint) {
+    checkpoint->global_history = bp->global_history;
+    checkpoint->position = bp->history->pos;
+    if (bp->config.type != BP_TAGE) return;
+    memcpy(checkpoint->folded, bp->tage.fold, sizeof(bp->tage.fold));
+}
+
+static inline void bp_restore_inline(bp_predictor *bp, const bp_checkpoint *checkpoint) {
+    bp->global_history = checkpoint->global_history;
+    bp->history->pos = checkpoint->position;
+    if (bp->config.type != BP_TAGE) return;
+    memcpy(bp->tage.fold, checkpoint->folded, sizeof(bp->tage.fold));
+}
+
+ /**
+ * Parks the running thread's history registers in its context and resumes
+ * thread's. The tables stay shared; only history is per thread.
+ */
+
+static inline void bp_switch_thread_inline(bp_predictor *bp, unsigned int thread) {
+    if (thread == bp->thread) return;
+    bp_checkpoint_inline(bp, &bp->contexts[bp->thread].checkpoint);
+    bp->thread = thread;
+    bp->history = &bp->contexts[thread].history;
+    bp_restore_inline(bp, &bp->contexts[thread].checkpoint);
+}
+
+static inline void bp_predict_inline(const bp_predictor *bp, unsigned long int addr, bp_prediction *pred) {
+    bp_predict_typed(bp, bp->config.type, addr, pred);
+}
+
+static inline int bp_train_inline(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    return bp_train_typed(bp, bp->config.type, pred, taken);
+}
+
+static inline int bp_update_inline(bp_predictor *bp, const bp_prediction *pred, int taken) {
+    int correct = bp_train_inline(bp, pred, taken);
+    bp_history_push_inline(bp, taken);
+    return correct;
+}
+
+#endif
@@ -0,0 +1,218 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bp_inline.h"
+
+#define BP_JIT_SYMBOL "bp_jit_batch"
+#define BP_JIT_NUM_CFLAGS (sizeof(jit_cflags) / sizeof(jit_cflags[0]))
+
+extern char **environ;
+
+ /**
+ * Compiler flags for the kernels. They are both passed to the compiler and
+ * written into the source, so the cache key changes whenever they do.
+ */
+
+static const char *const jit_cflags[] = { "-O3", "-shared", "-fPIC", "-w" };
+
+ /**
+ * Specialized kernels: for the counter-based predictors the whole batch loop
+ * is emitted as C with the geometry, history width and update policy as
+ * literal constants, compiled by the local C compiler into a shared object
+ * and loaded with dlopen, so every mask and shift folds into immediates.
+ * Objects are cached in a directory under a hash of their source (which
+ * records the compiler command too), so each geometry is compiled once.
+ *
+ * The kernel must behave exactly like step_tournament/step_typed in bp.c:
+ * one prediction, its training and the history push per branch.
+ */
+
+static const char kernel_body[] =
+    "#include <stddef.h>\n"
+    "\n"
+    "static inline void counter_update(unsigned char *c, int taken, int enable) {\n"
+    "    unsigned char v = *c;\n"
+    "    *c = v + (enable & taken & (v < 3)) - (enable & !taken & (v > 0));\n"
+    "}\n"
+    "\n"
+    "unsigned long int " BP_JIT_SYMBOL "(unsigned char *chooser, unsigned char *gshare, unsigned char *bimodal,\n"
+    "                               unsigned long int *history, const unsigned long int *addrs,\n"
+    "                               const unsigned char *taken, size_t count) {\n"
+    "    unsigned long int h = *history, mispredictions = 0;\n"
+    "    for (size_t i = 0; i < count; i++) {\n"
+    "        unsigned long int addr = addrs[i];\n"
+    "        int t = taken[i] != 0;\n"
+    "#if USES_GSHARE\n"
+    "        unsigned long int gi = ((((addr >> (GSHARE_SHIFT + 2)) & HISTORY_MASK) ^ h) << GSHARE_SHIFT) |\n"
+    "                               ((addr >> 2) & MLESSN_MASK);\n"
+    "        unsigned char g = gshare[gi];\n"
+    "#endif\n"
+    "#if USES_BIMODAL\n"
+    "        unsigned long int bi = (addr >> 2) & BIMODAL_MASK;\n"
+    "        unsigned char b = bimodal[bi];\n"
+    "#endif\n"
+    "#if USES_CHOOSER\n"
+    "        unsigned long int ci = (addr >> 2) & CHOOSER_MASK;\n"
+    "        unsigned char c = chooser[ci];\n"
+    "        int use_gshare = c >= 2;\n"
+    "        int predicted = (use_gshare ? g : b) >= 2;\n"
+    "        int g_correct = (g >= 2) == t, b_correct = (b >= 2) == t;\n"
+    "#if POLICY == 0\n"
+    "        if (use_gshare) counter_update(&gshare[gi], t, 1);\n"
+    "        else counter_update(&bimodal[bi], t, 1);\n"
+    "#else\n"
+    "        int enable = POLICY == 1 || ((g >= 2) != (b >= 2));\n"
+    "        counter_update(&gshare[gi], t, enable);\n"
+    "        counter_update(&bimodal[bi], t, enable);\n"
+    "#endif\n"
+    "        int disagree = g_correct != b_correct;\n"
+    "        chooser[ci] = c + (disagree & g_correct & (c < 3)) - (disagree & b_correct & (c > 0));\n"
+    "#elif USES_GSHARE\n"
+    "        int predicted = g >= 2;\n"
+    "        counter_update(&gshare[gi], t, 1);\n"
+    "#else\n"
+    "        int predicted = b >= 2;\n"
+    "        counter_update(&bimodal[bi], t, 1);\n"
+    "#endif\n"
+    "        h = ((t ? HISTORY_TOP : 0) | (h >> 1)) & HISTORY_MASK;\n"
+    "        mispredictions += predicted != t;\n"
+    "    }\n"
+    "    *history = h;\n"
+    "    return mispredictions;\n"
+    "}\n";
+
+ /**
+ * Returns nonzero if bp is a shape the kernel covers: bimodal, gshare or
+ * hybrid without a loop table and with a history that fits the index.
+ */
+
+static int jit_supported(const bp_predictor *bp) {
+    bp_type type = bp->config.type;
+    if (type != BP_BIMODAL && type != BP_GSHARE && type != BP_HYBRID) return 0;
+    return !bp->tables[BP_TABLE_LOOP] && !bp->long_history;
+}
+
+ /**
+ * Writes the kernel source for bp into a malloc'd string: the compiler
+ * command, the constants, then the fixed body.
+ */
+
+static char *jit_source(const bp_predictor *bp, const char *cc) {
+    bp_type type = bp->config.type;
+    char *text = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&text, &len);
+    if (!fp) return NULL;
+    fprintf(fp, "/* %s", cc);
+    for (size_t i = 0; i < BP_JIT_NUM_CFLAGS; i++) fprintf(fp, " %s", jit_cflags[i]);
+    fputs(" */\n", fp);
+    fprintf(fp, "#define USES_GSHARE %d\n", type != BP_BIMODAL);
+    fprintf(fp, "#define USES_BIMODAL %d\n", type != BP_GSHARE);
+    fprintf(fp, "#define USES_CHOOSER %d\n", type == BP_HYBRID);
+    fprintf(fp, "#define POLICY %d\n", (int)bp->config.policy);
+    fprintf(fp, "#define GSHARE_SHIFT %luUL\n", bp->gshare_shift);
+    fprintf(fp, "#define HISTORY_MASK %#lxUL\n", bp->history_mask);
+    fprintf(fp, "#define HISTORY_TOP %#lxUL\n", bp->history_top);
+    fprintf(fp, "#define MLESSN_MASK %#lxUL\n", bp->mlessn_mask);
+    fprintf(fp, "#define BIMODAL_MASK %#lxUL\n", bp->bimodal_mask);
+    fprintf(fp, "#define CHOOSER_MASK %#lxUL\n", bp->chooser_mask);
+    fputs(kernel_body, fp);
+    if (fclose(fp) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static uint64_t jit_hash(const char *text) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *text; text++) h = (h ^ (unsigned char)*text) * 1099511628211ULL;
+    return h;
+}
+
+ /**
+ * Runs "cc <flags> -o out src" with its output discarded.
+ * Returns 0 if the compiler ran and succeeded, -1 otherwise.
+ */
+
+static int jit_compile(const char *cc, const char *src, const char *out) {
+    char *argv[BP_JIT_NUM_CFLAGS + 5];
+    size_t argc = 0;
+    argv[argc++] = (char*)cc;
+    for (size_t i = 0; i < BP_JIT_NUM_CFLAGS; i++) argv[argc++] = (char*)jit_cflags[i];
+    argv[argc++] = "-o";
+    argv[argc++] = (char*)out;
+    argv[argc++] = (char*)src;
+    argv[argc] = NULL;
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int status;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    int spawned = posix_spawnp(&pid, cc, &actions, NULL, argv, environ) == 0;
+    posix_spawn_file_actions_destroy(&actions);
+    if (!spawned) return -1;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+ /**
+ * Switches bp_batch on bp to a kernel specialized for its exact geometry,
+ * building it with the compiler named by $CC (default "cc") unless dir
+ * already holds it. The kernel stays loaded for the life of the process.
+ * Dirty tracking and bp_step keep using the generic code.
+ * Returns 0 if the specialized kernel is in use, -1 if the configuration is
+ * not covered, no compiler is available or the build fails; bp is then
+ * unchanged and keeps the generic kernels.
+ */
+
+int bp_jit(bp_predictor *bp, const char *dir) {
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) cc = "cc";
+    if (!jit_supported(bp)) return -1;
+    char *text = jit_source(bp, cc);
+    if (!text) return -1;
+    char so[4096], src[4096], tmp[4096];
+    unsigned long long key = (unsigned long long)jit_hash(text);
+    snprintf(so, sizeof(so), "%s/bp_%016llx.so", dir, key);
+
+    if (access(so, R_OK) != 0) {
+        // Build under private names and rename, so concurrent runs never load a partial object
+        snprintf(src, sizeof(src), "%s/bp_%016llx.%ld.c", dir, key, (long)getpid());
+        snprintf(tmp, sizeof(tmp), "%s/bp_%016llx.%ld.so", dir, key, (long)getpid());
+        FILE *fp = (mkdir(dir, 0777) == 0 || errno == EEXIST) ? fopen(src, "w") : NULL;
+        int ok = fp != NULL;
+        if (fp) {
+            ok = fputs(text, fp) >= 0;
+            ok &= fclose(fp) == 0;
+        }
+        ok = ok && jit_compile(cc, src, tmp) == 0 && rename(tmp, so) == 0;
+        unlink(src);
+        if (!ok) {
+            unlink(tmp);
+            free(text);
+            return -1;
+        }
+    }
+    free(text);
+
+    void *handle = dlopen(so, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return -1;
+    bp_jit_fn kernel = (bp_jit_fn)dlsym(handle, BP_JIT_SYMBOL);
+    if (!kernel) {
+        dlclose(handle);
+        return -1;
+    }
+    bp->jit = kernel;
+    return 0;
+}
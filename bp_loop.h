@@ -0,0 +1,86 @@
+#ifndef BP_LOOP_H
+#define BP_LOOP_H
+
+#include <stdint.h>
+
+ /**
+ * Loop predictor entries (internal to libbp). Each entry is one 64-bit word:
+ *   bits  0-13  tag (PC bits above the index)
+ *   bits 14-27  trip count: body iterations seen in the last complete run
+ *   bits 28-41  iterations of the current run so far
+ *   bits 42-43  confidence: consecutive runs with the same trip count
+ *   bits 44-51  age, protecting the entry from replacement
+ *   bit  52     direction of the loop body (the exit goes the other way)
+ *   bit  53     valid
+ * The loop is predicted only when confidence is saturated: the body
+ * direction until the current run reaches the trip count, then the exit.
+ */
+
+#define BP_LOOP_TAG_BITS   14
+#define BP_LOOP_COUNT_BITS 14
+#define BP_LOOP_MAX_BITS   24
+#define BP_LOOP_CONFIDENT  3
+#define BP_LOOP_AGE_INIT   255
+
+#define BP_LOOP_TAG_MASK   ((1u << BP_LOOP_TAG_BITS) - 1)
+#define BP_LOOP_COUNT_MASK ((1u << BP_LOOP_COUNT_BITS) - 1)
+
+#define BP_LOOP_TAG(e)   ((unsigned int)(e) & BP_LOOP_TAG_MASK)
+#define BP_LOOP_TRIP(e)  ((unsigned int)((e) >> 14) & BP_LOOP_COUNT_MASK)
+#define BP_LOOP_ITER(e)  ((unsigned int)((e) >> 28) & BP_LOOP_COUNT_MASK)
+#define BP_LOOP_CONF(e)  ((unsigned int)((e) >> 42) & 3)
+#define BP_LOOP_AGE(e)   ((unsigned int)((e) >> 44) & 255)
+#define BP_LOOP_DIR(e)   ((unsigned int)((e) >> 52) & 1)
+#define BP_LOOP_VALID(e) ((unsigned int)((e) >> 53) & 1)
+#define BP_LOOP_ENTRY(tag, trip, iter, conf, age, dir) \
+    ((uint64_t)(tag) | ((uint64_t)(trip) << 14) | ((uint64_t)(iter) << 28) | \
+     ((uint64_t)(conf) << 42) | ((uint64_t)(age) << 44) | ((uint64_t)(dir) << 52) | (1ULL << 53))
+
+static inline uint64_t bp_loop_select(int cond, uint64_t a, uint64_t b) {
+    return b ^ ((a ^ b) & (0 - (uint64_t)cond));
+}
+
+static inline int bp_loop_hit(uint64_t e, unsigned int tag) {
+    return BP_LOOP_VALID(e) & (BP_LOOP_TAG(e) == tag);
+}
+
+static inline int bp_loop_confident(uint64_t e, unsigned int tag) {
+    return bp_loop_hit(e, tag) & (BP_LOOP_CONF(e) == BP_LOOP_CONFIDENT);
+}
+
+static inline int bp_loop_taken(uint64_t e) {
+    return (int)(BP_LOOP_DIR(e) ^ (BP_LOOP_ITER(e) == BP_LOOP_TRIP(e)));
+}
+
+ /**
+ * Returns the entry after one resolved branch, computing every outcome and
+ * selecting with masks so the data-dependent cases cost no branches.
+ * - Hit: the body direction advances the current run; the exit compares it
+ *   with the trip count, building confidence on a repeat and relearning the
+ *   trip count otherwise. A confident wrong prediction or a run too long to
+ *   count frees the entry. Age grows when the loop fixed a base mistake.
+ * - Miss: when the base predictor was wrong, an entry of age 0 is replaced
+ *   by one for this branch (the outcome just mispredicted is taken as the
+ *   exit); otherwise its age drops by one.
+ */
+
+static inline uint64_t bp_loop_update(uint64_t e, unsigned int tag, int taken, int base_wrong) {
+    unsigned int trip = BP_LOOP_TRIP(e), iter = BP_LOOP_ITER(e), conf = BP_LOOP_CONF(e), age = BP_LOOP_AGE(e), dir = BP_LOOP_DIR(e);
+    int confident = bp_loop_confident(e, tag);
+    int correct = bp_loop_taken(e) == taken;
+    int body = (unsigned int)taken == dir;
+    unsigned int exit_conf = (conf + (conf < BP_LOOP_CONFIDENT)) & (0u - (unsigned int)(iter == trip));
+    uint64_t hit = BP_LOOP_ENTRY(tag,
+                                 body ? trip : iter,
+                                 (iter + 1) & (0u - (unsigned int)body),
+                                 body ? conf : exit_conf,
+                                 age + (confident & correct & base_wrong & (age < 255)),
+                                 dir);
+    hit = bp_loop_select((confident & !correct) | (body & (iter + 1 > BP_LOOP_COUNT_MASK)), 0, hit);
+    uint64_t miss = bp_loop_select(base_wrong & (age == 0),
+                                   BP_LOOP_ENTRY(tag, 0, 0, 0, BP_LOOP_AGE_INIT, !taken),
+                                   e - ((uint64_t)(base_wrong & (age > 0)) << 44));
+    return bp_loop_select(bp_loop_hit(e, tag), hit, miss);
+}
+
+#endif
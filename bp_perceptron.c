@@ -0,0 +1,192 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "bp_perceptron.h"
+
+ /**
+ * Reference scalar kernels. Weights saturate symmetrically at +/-127 so that
+ * negating one never overflows an int8 in the vector kernels.
+ */
+
+static long int dot_scalar(const signed char *weights, unsigned long int x, unsigned long int valid) {
+    long int sum = 0;
+    for (int i = 0; i < BP_PERCEPTRON_ROW; i++) {
+        if (!((valid >> i) & 1)) continue;
+        sum += ((x >> i) & 1) ? weights[i] : -weights[i];
+    }
+    return sum;
+}
+
+static void train_scalar(signed char *weights, unsigned long int x, unsigned long int valid, int taken) {
+    for (int i = 0; i < BP_PERCEPTRON_ROW; i++) {
+        if (!((valid >> i) & 1)) continue;
+        int w = weights[i] + ((((x >> i) & 1) == (unsigned long)taken) ? 1 : -1);
+        if (w > BP_PERCEPTRON_MAX_W) w = BP_PERCEPTRON_MAX_W;
+        if (w < -BP_PERCEPTRON_MAX_W) w = -BP_PERCEPTRON_MAX_W;
+        weights[i] = (signed char)w;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+ /**
+ * Expands 16 bits of a mask into 16 byte lanes of 0xFF (set) or 0x00 (clear).
+ */
+
+__attribute__((target("sse4.2")))
+static inline __m128i expand_bits_sse42(unsigned int bits) {
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+    const __m128i select = _mm_set1_epi64x(0x8040201008040201LL);
+    __m128i v = _mm_shuffle_epi8(_mm_cvtsi32_si128((int)bits), spread);
+    return _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+}
+
+ /**
+ * Builds the +1/-1/0 input lanes for one quarter (16 lanes) of a row.
+ */
+
+__attribute__((target("sse4.2")))
+static inline __m128i inputs_sse42(unsigned int x, unsigned int valid) {
+    __m128i set = expand_bits_sse42(x & 0xFFFF);
+    __m128i on = expand_bits_sse42(valid & 0xFFFF);
+    __m128i sign = _mm_or_si128(_mm_and_si128(set, _mm_set1_epi8(1)), _mm_andnot_si128(set, _mm_set1_epi8(-1)));
+    return _mm_and_si128(sign, on);
+}
+
+__attribute__((target("sse4.2")))
+static long int dot_sse42(const signed char *weights, unsigned long int x, unsigned long int valid) {
+    const __m128i ones8 = _mm_set1_epi8(1);
+    __m128i sum16 = _mm_setzero_si128();
+    for (int quarter = 0; quarter < 4; quarter++) {
+        __m128i in = inputs_sse42((unsigned int)(x >> (16 * quarter)), (unsigned int)(valid >> (16 * quarter)));
+        __m128i w = _mm_sign_epi8(_mm_loadu_si128((const __m128i*)(weights + 16 * quarter)), in);
+        sum16 = _mm_add_epi16(sum16, _mm_maddubs_epi16(ones8, w));
+    }
+    __m128i s = _mm_madd_epi16(sum16, _mm_set1_epi16(1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("sse4.2")))
+static void train_sse42(signed char *weights, unsigned long int x, unsigned long int valid, int taken) {
+    const __m128i direction = _mm_set1_epi8(taken ? 1 : -1);
+    const __m128i floor = _mm_set1_epi8(-BP_PERCEPTRON_MAX_W);
+    for (int quarter = 0; quarter < 4; quarter++) {
+        __m128i *row = (__m128i*)(weights + 16 * quarter);
+        __m128i in = inputs_sse42((unsigned int)(x >> (16 * quarter)), (unsigned int)(valid >> (16 * quarter)));
+        __m128i w = _mm_adds_epi8(_mm_loadu_si128(row), _mm_sign_epi8(direction, in));
+        _mm_storeu_si128(row, _mm_max_epi8(w, floor));
+    }
+}
+
+ /**
+ * Expands 32 bits of a mask into 32 byte lanes of 0xFF (set) or 0x00 (clear).
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i expand_bits_avx2(unsigned int bits) {
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), spread);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select);
+}
+
+ /**
+ * Builds the +1/-1/0 input lanes for one half (32 lanes) of a row.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i inputs_avx2(unsigned int x, unsigned int valid) {
+    __m256i set = expand_bits_avx2(x);
+    __m256i on = expand_bits_avx2(valid);
+    __m256i sign = _mm256_or_si256(_mm256_and_si256(set, _mm256_set1_epi8(1)), _mm256_andnot_si256(set, _mm256_set1_epi8(-1)));
+    return _mm256_and_si256(sign, on);
+}
+
+__attribute__((target("avx2")))
+static long int dot_avx2(const signed char *weights, unsigned long int x, unsigned long int valid) {
+    __m256i lo = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)weights), inputs_avx2((unsigned int)x, (unsigned int)valid));
+    __m256i hi = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(weights + 32)), inputs_avx2((unsigned int)(x >> 32), (unsigned int)(valid >> 32)));
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    __m256i sum16 = _mm256_add_epi16(_mm256_maddubs_epi16(ones8, lo), _mm256_maddubs_epi16(ones8, hi));
+    __m256i sum32 = _mm256_madd_epi16(sum16, ones16);
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum32), _mm256_extracti128_si256(sum32, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static void train_avx2(signed char *weights, unsigned long int x, unsigned long int valid, int taken) {
+    const __m256i direction = _mm256_set1_epi8(taken ? 1 : -1);
+    const __m256i floor = _mm256_set1_epi8(-BP_PERCEPTRON_MAX_W);
+    for (int half = 0; half < 2; half++) {
+        __m256i *row = (__m256i*)(weights + 32 * half);
+        __m256i in = inputs_avx2((unsigned int)(x >> (32 * half)), (unsigned int)(valid >> (32 * half)));
+        __m256i w = _mm256_adds_epi8(_mm256_loadu_si256(row), _mm256_sign_epi8(direction, in));
+        _mm256_storeu_si256(row, _mm256_max_epi8(w, floor));
+    }
+}
+
+ /**
+ * A whole row fits one 512-bit register and the input bits are used directly
+ * as lane masks: weights whose history bit is clear are negated, invalid
+ * lanes are zeroed, and the signed bytes are summed by offsetting them to
+ * unsigned and adding absolute differences against zero.
+ */
+
+__attribute__((target("avx512f,avx512bw")))
+static long int dot_avx512(const signed char *weights, unsigned long int x, unsigned long int valid) {
+    __m512i w = _mm512_maskz_loadu_epi8((__mmask64)valid, weights);
+    w = _mm512_mask_sub_epi8(w, (__mmask64)~x, _mm512_setzero_si512(), w);
+    __m512i sum = _mm512_sad_epu8(_mm512_xor_si512(w, _mm512_set1_epi8((char)0x80)), _mm512_setzero_si512());
+    return (long int)_mm512_reduce_add_epi64(sum) - BP_PERCEPTRON_ROW * 128;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void train_avx512(signed char *weights, unsigned long int x, unsigned long int valid, int taken) {
+    const __m512i one = _mm512_set1_epi8(1);
+    __mmask64 agree = (__mmask64)((taken ? x : ~x) & valid);
+    __mmask64 disagree = (__mmask64)(~(taken ? x : ~x) & valid);
+    __m512i w = _mm512_loadu_si512(weights);
+    w = _mm512_mask_adds_epi8(w, agree, w, one);
+    w = _mm512_mask_subs_epi8(w, disagree, w, one);
+    _mm512_storeu_si512(weights, _mm512_max_epi8(w, _mm512_set1_epi8(-BP_PERCEPTRON_MAX_W)));
+}
+
+#endif
+
+ /**
+ * Picks the kernels for the requested instruction set (the widest one the
+ * CPU supports for BP_ISA_AUTO). Only the scalar ones exist off x86.
+ * Returns -1 if a forced ISA is not supported by this CPU.
+ */
+
+int bp_perceptron_select(bp_isa isa, bp_perceptron_kernels *kernels) {
+    if (isa == BP_ISA_AUTO) isa = bp_isa_best();
+    if (!bp_isa_supported(isa)) return -1;
+    switch (isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    case BP_ISA_SSE42:
+        kernels->dot = dot_sse42;
+        kernels->train = train_sse42;
+        break;
+    case BP_ISA_AVX2:
+        kernels->dot = dot_avx2;
+        kernels->train = train_avx2;
+        break;
+    case BP_ISA_AVX512:
+        kernels->dot = dot_avx512;
+        kernels->train = train_avx512;
+        break;
+#endif
+    default:
+        kernels->dot = dot_scalar;
+        kernels->train = train_scalar;
+        break;
+    }
+    return 0;
+}
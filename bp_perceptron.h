@@ -0,0 +1,28 @@
+#ifndef BP_PERCEPTRON_H
+#define BP_PERCEPTRON_H
+
+#include "bp.h"
+
+ /**
+ * Perceptron kernels (internal to libbp).
+ * Each weight vector is one 64-byte row of int8 weights: lane i < H weighs
+ * history bit i, lane H is the bias, and the remaining lanes stay zero.
+ * Inputs are passed as a bit vector x (bit H set for the bias) plus a mask of
+ * the H+1 valid lanes; a set bit counts as +1 and a clear one as -1.
+ */
+
+#define BP_PERCEPTRON_ROW      64
+#define BP_PERCEPTRON_MAX_H    (BP_PERCEPTRON_ROW - 1)
+#define BP_PERCEPTRON_MAX_W    127
+
+typedef long int (*bp_perceptron_dot_fn)(const signed char *weights, unsigned long int x, unsigned long int valid);
+typedef void (*bp_perceptron_train_fn)(signed char *weights, unsigned long int x, unsigned long int valid, int taken);
+
+typedef struct bp_perceptron_kernels{
+    bp_perceptron_dot_fn   dot;
+    bp_perceptron_train_fn train;
+}bp_perceptron_kernels;
+
+int bp_perceptron_select(bp_isa isa, bp_perceptron_kernels *kernels);
+
+#endif
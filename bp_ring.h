@@ -0,0 +1,195 @@
+#ifndef BP_RING_H
+#define BP_RING_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ /**
+ * Single-producer/single-consumer ring of branch records in POSIX shared
+ * memory, for feeding sim live from a tracer ("sim gshare 9 3 ring:/name").
+ * Header-only so a producer just includes this file (link with -lrt on
+ * older glibc):
+ *
+ *   bp_ring *ring = bp_ring_open("/mytrace", 1 << 20);
+ *   bp_ring_push(ring, pc, taken);  ...
+ *   bp_ring_close(ring);             // marks end of trace
+ *
+ * Records are stored as two parallel arrays (64-bit addresses and outcomes),
+ * the same layout bp_batch takes on an LP64 consumer, so it simulates
+ * straight out of the mapping. The widths are fixed so a 32-bit producer
+ * writes the same layout. Head and tail sit on separate cache lines and each
+ * side caches the other's index, so the fast path is plain loads and stores
+ * with no syscalls; a side only yields the CPU after spinning on a full or
+ * empty ring.
+ */
+
+#define BP_RING_MAGIC    0x42505231u
+#define BP_RING_SPINS    4096
+
+typedef struct bp_ring_header{
+    uint32_t          magic;
+    uint32_t          closed;
+    uint64_t          capacity;
+    char              pad0[48];
+    volatile uint64_t head;     /* written by the producer only */
+    char              pad1[56];
+    volatile uint64_t tail;     /* written by the consumer only */
+    char              pad2[56];
+}bp_ring_header;
+
+typedef struct bp_ring{
+    bp_ring_header    *header;
+    uint64_t          *addrs;
+    unsigned char     *taken;
+    uint64_t          mask;
+    uint64_t          cached_head;
+    uint64_t          cached_tail;
+    size_t            map_size;
+}bp_ring;
+
+static inline size_t bp_ring_map_size(uint64_t capacity) {
+    return sizeof(bp_ring_header) + capacity * (sizeof(uint64_t) + 1);
+}
+
+static inline void bp_ring_wait(unsigned *spins) {
+    if (++*spins < BP_RING_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+ /**
+ * Creates the ring, or attaches to it if the other side created it first.
+ * capacity is rounded up to a power of two and only used by the creator.
+ * Returns NULL on failure.
+ */
+
+static inline bp_ring *bp_ring_open(const char *name, uint64_t capacity) {
+    uint64_t cap = 1024;
+    while (cap < capacity) cap <<= 1;
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) return NULL;
+
+    bp_ring *ring = (bp_ring*)calloc(1, sizeof(bp_ring));
+    if (!ring) goto fail;
+    if (created) {
+        if (ftruncate(fd, bp_ring_map_size(cap)) != 0) goto fail;
+    } else {
+        struct stat st;
+        for (unsigned spins = 0; ; bp_ring_wait(&spins)) {
+            if (fstat(fd, &st) != 0) goto fail;
+            if ((size_t)st.st_size >= sizeof(bp_ring_header)) break;
+        }
+    }
+    bp_ring_header *header = (bp_ring_header*)mmap(NULL, sizeof(bp_ring_header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) goto fail;
+    if (created) {
+        header->capacity = cap;
+        __atomic_store_n(&header->magic, BP_RING_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        unsigned spins = 0;
+        while (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != BP_RING_MAGIC) bp_ring_wait(&spins);
+        cap = header->capacity;
+    }
+    munmap(header, sizeof(bp_ring_header));
+
+    ring->map_size = bp_ring_map_size(cap);
+    void *map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) goto fail;
+    close(fd);
+    ring->header = (bp_ring_header*)map;
+    ring->addrs = (uint64_t*)(ring->header + 1);
+    ring->taken = (unsigned char*)(ring->addrs + cap);
+    ring->mask = cap - 1;
+    ring->cached_head = ring->header->head;
+    ring->cached_tail = ring->header->tail;
+    return ring;
+
+fail:
+    close(fd);
+    free(ring);
+    return NULL;
+}
+
+ /**
+ * Producer: appends one record, waiting while the ring is full.
+ */
+
+static inline void bp_ring_push(bp_ring *ring, uint64_t addr, int taken) {
+    uint64_t head = ring->header->head;
+    if (head - ring->cached_tail > ring->mask) {
+        unsigned spins = 0;
+        while (head - (ring->cached_tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE)) > ring->mask) {
+            bp_ring_wait(&spins);
+        }
+    }
+    ring->addrs[head & ring->mask] = addr;
+    ring->taken[head & ring->mask] = taken != 0;
+    __atomic_store_n(&ring->header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+ /**
+ * Consumer: waits for records and returns how many are readable contiguously
+ * starting at *index (0 once the producer closed the ring and it is drained).
+ * The records stay valid until bp_ring_release.
+ */
+
+static inline size_t bp_ring_peek(bp_ring *ring, size_t *index) {
+    uint64_t tail = ring->header->tail;
+    if (ring->cached_head == tail) {
+        unsigned spins = 0;
+        while ((ring->cached_head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE)) == tail) {
+            if (__atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE)) {
+                ring->cached_head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+                if (ring->cached_head == tail) return 0;
+                break;
+            }
+            bp_ring_wait(&spins);
+        }
+    }
+    *index = tail & ring->mask;
+    uint64_t available = ring->cached_head - tail;
+    uint64_t until_wrap = ring->mask + 1 - *index;
+    return available < until_wrap ? available : until_wrap;
+}
+
+static inline void bp_ring_release(bp_ring *ring, size_t count) {
+    __atomic_store_n(&ring->header->tail, ring->header->tail + count, __ATOMIC_RELEASE);
+}
+
+ /**
+ * Producer: marks the end of the trace and detaches.
+ */
+
+static inline void bp_ring_close(bp_ring *ring) {
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring->header, ring->map_size);
+    free(ring);
+}
+
+ /**
+ * Consumer: detaches and removes the shared memory object.
+ */
+
+static inline void bp_ring_destroy(bp_ring *ring, const char *name) {
+    munmap(ring->header, ring->map_size);
+    shm_unlink(name);
+    free(ring);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <math.h>
+#include <string.h>
+#include "bp_tage.h"
+
+ /**
+ * Sets up component geometry: history lengths grow geometrically from Lmin
+ * (shortest component) to Lmax (longest), and each folded register records
+ * where the bit leaving its window lands after folding.
+ */
+
+void bp_tage_init(bp_tage *tage, const bp_config *config) {
+    memset(tage, 0, sizeof(*tage));
+    tage->tables = (unsigned int)config->T;
+    tage->index_bits = (unsigned int)config->B;
+    tage->index_mask = (1u << config->B) - 1;
+    tage->width[0] = tage->index_bits;
+    tage->width[1] = BP_TAGE_TAG_BITS;
+    tage->width[2] = BP_TAGE_TAG_BITS - 1;
+    for (int k = 0; k < BP_TAGE_FOLDS; k++) {
+        tage->mask[k] = (1u << tage->width[k]) - 1;
+    }
+    for (unsigned int i = 0; i < tage->tables; i++) {
+        double ratio = tage->tables > 1 ? (double)i / (tage->tables - 1) : 0.0;
+        unsigned int length = (unsigned int)(config->Lmin * pow((double)config->Lmax / config->Lmin, ratio) + 0.5);
+        tage->length[i] = length;
+        tage->offset[i] = i << tage->index_bits;
+        for (int k = 0; k < BP_TAGE_FOLDS; k++) {
+            tage->out_bit[k][i] = 1u << (length % tage->width[k]);
+        }
+    }
+}
+
+ /**
+ * Picks the build of the hot steps for the requested instruction set (the
+ * widest one the CPU supports for BP_ISA_AUTO): AVX2 and AVX-512 run the
+ * AVX2 build, SSE4.2 the SSE2 one and scalar the plain C reference.
+ * Returns -1 if a forced ISA is not supported by this CPU.
+ */
+
+int bp_tage_select(bp_isa isa, bp_tage *tage) {
+    if (isa == BP_ISA_AUTO) isa = bp_isa_best();
+    if (!bp_isa_supported(isa)) return -1;
+    tage->build = isa == BP_ISA_AVX2 || isa == BP_ISA_AVX512 ? BP_TAGE_AVX2 : isa == BP_ISA_SSE42 ? BP_TAGE_SSE2 : BP_TAGE_SCALAR;
+    return 0;
+}
+
+ /**
+ * Clears the folded registers and the adaptive counters (the tagged entries
+ * and the history buffer are cleared with the rest of the predictor).
+ */
+
+void bp_tage_reset(bp_tage *tage) {
+    memset(tage->fold, 0, sizeof(tage->fold));
+    tage->use_alt = 0;
+    tage->tick = 0;
+}
+
+ /**
+ * Periodically halves every useful counter so stale entries become
+ * replaceable again.
+ */
+
+void bp_tage_age(bp_tage *tage, uint16_t *entries) {
+    size_t count = (size_t)tage->tables << tage->index_bits;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t e = entries[i];
+        entries[i] = BP_TAGE_ENTRY(BP_TAGE_CTR(e), BP_TAGE_U(e) >> 1, BP_TAGE_TAG(e));
+    }
+    tage->tick = 0;
+}
+
+ /**
+ * Prints tagged entry index (component << B | slot) as
+ * "<component> <slot>      <ctr> <useful> <tag>".
+ */
+
+void bp_tage_print_entry(const bp_tage *tage, const uint16_t *entries, unsigned long index, FILE *out) {
+    uint16_t e = entries[index];
+    fprintf(out, "%lu %lu      %u %u %u\n", index >> tage->index_bits, index & tage->index_mask, BP_TAGE_CTR(e), BP_TAGE_U(e), BP_TAGE_TAG(e));
+}
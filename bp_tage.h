@@ -0,0 +1,344 @@
+#ifndef BP_TAGE_H
+#define BP_TAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "bp.h"
+#include "bp_history.h"
+
+ /**
+ * TAGE engine (internal to libbp): a bimodal base predictor plus T tagged
+ * components indexed with geometrically increasing global history lengths.
+ *
+ * - Each tagged entry is packed into 16 bits (3-bit counter, 2-bit useful,
+ *   11-bit tag), so a component lookup reads one naturally aligned halfword
+ *   and therefore exactly one cache line.
+ * - History is the predictor's shared circular buffer (bp_history.h). For
+ *   every component three folded registers (index, tag, second tag) compress
+ *   its window; pushing a branch updates each one in O(1) by shifting in the
+ *   new bit and XORing out the bit that falls off the end, instead of
+ *   re-hashing the whole window.
+ */
+
+#define BP_TAGE_TAG_BITS     11
+#define BP_TAGE_MAX_INDEX    24
+#define BP_TAGE_USE_ALT_MAX  7
+#define BP_TAGE_RESET_PERIOD (1UL << 18)
+#define BP_TAGE_FOLDS        3
+#define BP_TAGE_LANES        4
+#define BP_TAGE_AVX2_LANES   8
+
+#define BP_TAGE_CTR(e)   ((e) & 7)
+#define BP_TAGE_U(e)     (((e) >> 3) & 3)
+#define BP_TAGE_TAG(e)   ((e) >> 5)
+#define BP_TAGE_ENTRY(ctr, u, tag) ((uint16_t)((ctr) | ((u) << 3) | ((tag) << 5)))
+
+typedef enum bp_tage_build{
+    BP_TAGE_SCALAR,
+    BP_TAGE_SSE2,
+    BP_TAGE_AVX2
+}bp_tage_build;
+
+typedef struct bp_tage{
+    unsigned int      tables;
+    unsigned int      index_bits;
+    unsigned int      index_mask;
+    unsigned int      length[BP_TAGE_MAX_TABLES];
+    unsigned int      width[BP_TAGE_FOLDS];                           /* bits per folded register kind */
+    unsigned int      fold[BP_TAGE_FOLDS][BP_TAGE_MAX_TABLES];        /* index, tag and second tag folds */
+    unsigned int      out_bit[BP_TAGE_FOLDS][BP_TAGE_MAX_TABLES];     /* where the bit leaving a window lands */
+    unsigned int      mask[BP_TAGE_FOLDS];                            /* (1 << width) - 1 */
+    unsigned int      offset[BP_TAGE_MAX_TABLES];                     /* first entry of each component */
+    bp_tage_build     build;                                          /* which build runs the hot steps */
+    int               use_alt;                                        /* trust alt over weak new entries if >= 0 */
+    unsigned long int tick;
+}bp_tage;
+
+void bp_tage_init(bp_tage *tage, const bp_config *config);
+int bp_tage_select(bp_isa isa, bp_tage *tage);
+void bp_tage_reset(bp_tage *tage);
+void bp_tage_age(bp_tage *tage, uint16_t *entries);
+void bp_tage_print_entry(const bp_tage *tage, const uint16_t *entries, unsigned long index, FILE *out);
+
+ /**
+ * Finds the longest-history matching component (provider) and the next one
+ * (alternate), falling back to the base counter when nothing matches. A weak
+ * provider defers to the alternate while use_alt says that pays off.
+ * hits has bit i set if component i matched, and entry holds the entries
+ * read, so the provider and alternate counters need no second lookup.
+ */
+
+static inline __attribute__((always_inline)) void bp_tage_decide(const bp_tage *tage, unsigned int hits, const uint16_t *entry, unsigned char base,
+                                                                 bp_prediction *pred) {
+    int provider = hits ? 31 - __builtin_clz(hits) : -1;
+    unsigned int rest = hits & ~(1u << (provider & 31));
+    int alt = rest ? 31 - __builtin_clz(rest) : -1;
+    int base_taken = base >= 2;
+    int alt_taken = alt >= 0 ? BP_TAGE_CTR(entry[alt]) >= 4 : base_taken;
+    pred->tage_provider = provider;
+    pred->tage_alt_taken = alt_taken;
+    if (provider < 0) {
+        pred->tage_provider_taken = base_taken;
+        pred->taken = base_taken;
+        pred->confidence = base == 0 || base == 3;
+        return;
+    }
+    unsigned int ctr = BP_TAGE_CTR(entry[provider]);
+    int weak = ctr == 3 || ctr == 4;
+    pred->tage_provider_taken = ctr >= 4;
+    pred->taken = weak && tage->use_alt >= 0 ? alt_taken : (int)(ctr >= 4);
+    pred->confidence = ctr == 0 || ctr == 7;
+}
+
+ /**
+ * Plain C build of the hot steps: the only one off x86, and the reference
+ * that BP_ISA_SCALAR selects and the vector builds below must match.
+ * Moves every folded register on by the outcome just shifted into history.
+ */
+
+static inline void bp_tage_push(bp_tage *tage, const bp_history *history, int taken) {
+    unsigned int out[BP_TAGE_MAX_TABLES];
+    for (unsigned int i = 0; i < tage->tables; i++) {
+        out[i] = 0u - bp_history_bit(history, tage->length[i]);
+    }
+    for (int k = 0; k < BP_TAGE_FOLDS; k++) {
+        unsigned int width = tage->width[k];
+        for (unsigned int i = 0; i < tage->tables; i++) {
+            tage->fold[k][i] = bp_fold_update(tage->fold[k][i], width, taken, out[i] & tage->out_bit[k][i]);
+        }
+    }
+}
+
+ /**
+ * Hashes the index and tag of every component, reads the entries and
+ * decides as above.
+ */
+
+static inline void bp_tage_predict(const bp_tage *tage, const uint16_t *entries, unsigned char base, unsigned long int addr, bp_prediction *pred) {
+    unsigned long pc = addr >> 2;
+    unsigned int hashed_pc = (unsigned int)(pc ^ (pc >> tage->index_bits));
+    uint16_t entry[BP_TAGE_MAX_TABLES];
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < tage->tables; i++) {
+        unsigned int index = (hashed_pc ^ (i << 1) ^ tage->fold[0][i]) & tage->index_mask;
+        pred->tage_index[i] = tage->offset[i] | index;
+        pred->tage_tag[i] = (unsigned short)(((unsigned int)pc ^ tage->fold[1][i] ^ (tage->fold[2][i] << 1)) & ((1u << BP_TAGE_TAG_BITS) - 1));
+    }
+    for (unsigned int i = 0; i < tage->tables; i++) {
+        entry[i] = entries[pred->tage_index[i]];
+        hits |= (unsigned int)(BP_TAGE_TAG(entry[i]) == pred->tage_tag[i]) << i;
+    }
+    bp_tage_decide(tage, hits, entry, base, pred);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+ /**
+ * On x86 the hot steps also come in two vector builds, picked by
+ * bp_tage_select from the configured instruction set:
+ * - SSE2 (every x86-64 CPU): GCC vectors of BP_TAGE_LANES components, with
+ *   the departing history bits and the tagged entries read one at a time.
+ * - AVX2: BP_TAGE_AVX2_LANES components per vector, both reads done as
+ *   gathers. Tables keep readable slack past their end for the entry gather,
+ *   which reads each 16-bit entry together with the next one.
+ * Both take the number of vectors (groups) as a parameter so bp.c can build
+ * batch loops where it is constant and the loops over groups unroll. Lanes
+ * past the last component see length 0, offset 0 and out bits 0, so they
+ * read valid memory, never match and keep their folds at zero.
+ */
+
+typedef unsigned int bp_tage_lanes __attribute__((vector_size(BP_TAGE_LANES * sizeof(unsigned int))));
+typedef unsigned short bp_tage_halves __attribute__((vector_size(BP_TAGE_LANES * sizeof(unsigned int))));
+
+static inline unsigned int bp_tage_groups(const bp_tage *tage, unsigned int lanes) {
+    return (tage->tables + lanes - 1) / lanes;
+}
+
+static inline bp_tage_lanes bp_tage_load(const unsigned int *lanes) {
+    bp_tage_lanes v;
+    memcpy(&v, lanes, sizeof(v));
+    return v;
+}
+
+static inline void bp_tage_store(unsigned int *lanes, bp_tage_lanes v) {
+    memcpy(lanes, &v, sizeof(v));
+}
+
+ /**
+ * Tags of the BP_TAGE_LANES components from first on.
+ */
+
+static inline bp_tage_lanes bp_tage_tags(const bp_tage *tage, unsigned int pc, unsigned int first) {
+    bp_tage_lanes tag = pc ^ bp_tage_load(&tage->fold[1][first]) ^ (bp_tage_load(&tage->fold[2][first]) << 1);
+    return tag & ((1u << BP_TAGE_TAG_BITS) - 1);
+}
+
+ /**
+ * Moves every folded register on by the outcome just shifted into history,
+ * as bp_fold_update does for one. The departing bits are gathered into a
+ * mask first and handed to each group of lanes with one compare.
+ */
+
+static inline __attribute__((always_inline)) void bp_tage_push_sse2(bp_tage *tage, unsigned int groups, const bp_history *history, int taken) {
+    bp_tage_lanes shifted[BP_TAGE_MAX_TABLES / BP_TAGE_LANES], leaving[BP_TAGE_MAX_TABLES / BP_TAGE_LANES];
+    unsigned int out = 0;
+    for (unsigned int i = 0; i < groups * BP_TAGE_LANES; i++) {
+        out |= bp_history_bit(history, tage->length[i]) << i;
+    }
+    for (unsigned int g = 0; g < groups; g++) {
+        bp_tage_lanes component = (bp_tage_lanes){0, 1, 2, 3} + g * BP_TAGE_LANES;
+        shifted[g] = (bp_tage_lanes)(component < tage->tables) & (unsigned int)taken;
+        leaving[g] = (bp_tage_lanes)((out & ((bp_tage_lanes){1, 2, 4, 8} << (g * BP_TAGE_LANES))) != 0);
+    }
+    for (int k = 0; k < BP_TAGE_FOLDS; k++) {
+        unsigned int width = tage->width[k], mask = tage->mask[k];
+        for (unsigned int g = 0; g < groups; g++) {
+            unsigned int *fold = &tage->fold[k][g * BP_TAGE_LANES];
+            bp_tage_lanes v = (bp_tage_load(fold) << 1) | shifted[g];
+            v ^= bp_tage_load(&tage->out_bit[k][g * BP_TAGE_LANES]) & leaving[g];
+            v ^= v >> width;
+            bp_tage_store(fold, v & mask);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void bp_tage_push_avx2(bp_tage *tage, unsigned int groups, const bp_history *history, int taken) {
+    __m256i shifted[BP_TAGE_MAX_TABLES / BP_TAGE_AVX2_LANES], leaving[BP_TAGE_MAX_TABLES / BP_TAGE_AVX2_LANES];
+    for (unsigned int g = 0; g < groups; g++) {
+        unsigned int first = g * BP_TAGE_AVX2_LANES;
+        __m256i component = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)first));
+        __m256i at = _mm256_add_epi32(_mm256_set1_epi32((int)history->pos), _mm256_loadu_si256((const __m256i*)&tage->length[first]));
+        at = _mm256_and_si256(at, _mm256_set1_epi32(BP_HISTORY_BUFFER - 1));
+        __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)tage->tables), component);
+        __m256i start = _mm256_min_epu32(at, _mm256_set1_epi32(BP_HISTORY_BUFFER - 4));
+        __m256i bits = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)history->bits, start, live, 1);
+        __m256i up = _mm256_sub_epi32(_mm256_set1_epi32(31), _mm256_slli_epi32(_mm256_sub_epi32(at, start), 3));
+        leaving[g] = _mm256_srai_epi32(_mm256_sllv_epi32(bits, up), 31);
+        shifted[g] = _mm256_and_si256(live, _mm256_set1_epi32(taken));
+    }
+    for (int k = 0; k < BP_TAGE_FOLDS; k++) {
+        __m128i width = _mm_cvtsi32_si128((int)tage->width[k]);
+        __m256i mask = _mm256_set1_epi32((int)tage->mask[k]);
+        for (unsigned int g = 0; g < groups; g++) {
+            __m256i *fold = (__m256i*)&tage->fold[k][g * BP_TAGE_AVX2_LANES];
+            __m256i v = _mm256_or_si256(_mm256_slli_epi32(_mm256_loadu_si256(fold), 1), shifted[g]);
+            v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&tage->out_bit[k][g * BP_TAGE_AVX2_LANES]), leaving[g]));
+            v = _mm256_xor_si256(v, _mm256_srl_epi32(v, width));
+            _mm256_storeu_si256(fold, _mm256_and_si256(v, mask));
+        }
+    }
+}
+
+ /**
+ * Hashes the indices and tags of every component ahead of the table reads,
+ * so the reads can all issue at once, then compares the entries read with
+ * their tags eight at a time.
+ */
+
+static inline __attribute__((always_inline)) void bp_tage_predict_sse2(const bp_tage *tage, unsigned int groups, const uint16_t *entries, unsigned char base,
+                                                                  unsigned long int addr, bp_prediction *pred) {
+    unsigned long pc = addr >> 2;
+    unsigned int hashed_pc = (unsigned int)(pc ^ (pc >> tage->index_bits));
+    unsigned int lanes = groups * BP_TAGE_LANES;
+    uint16_t entry[BP_TAGE_MAX_TABLES];
+    unsigned int hits = 0;
+    if (tage->tables > lanes) __builtin_unreachable();    // groups cover every component
+    for (unsigned int g = 0; g < groups; g++) {
+        bp_tage_lanes component = (bp_tage_lanes){0, 1, 2, 3} + g * BP_TAGE_LANES;
+        bp_tage_lanes index = (hashed_pc ^ (component << 1) ^ bp_tage_load(&tage->fold[0][g * BP_TAGE_LANES])) & tage->index_mask;
+        bp_tage_store(&pred->tage_index[g * BP_TAGE_LANES], bp_tage_load(&tage->offset[g * BP_TAGE_LANES]) | index);
+    }
+    for (unsigned int h = 0; h < lanes; h += 8) {
+        bp_tage_lanes high = h + BP_TAGE_LANES < lanes ? bp_tage_tags(tage, (unsigned int)pc, h + BP_TAGE_LANES) : (bp_tage_lanes){0};
+        bp_tage_halves tag = (bp_tage_halves)_mm_packs_epi32((__m128i)bp_tage_tags(tage, (unsigned int)pc, h), (__m128i)high), read = {0};
+        memcpy(&pred->tage_tag[h], &tag, sizeof(tag));
+        for (unsigned int j = 0; j < 8 && h + j < lanes; j++) {
+            read[j] = entries[pred->tage_index[h + j]];
+        }
+        __m128i same = (__m128i)(BP_TAGE_TAG(read) == tag);
+        hits |= (unsigned int)_mm_movemask_epi8(_mm_packs_epi16(same, _mm_setzero_si128())) << h;
+        memcpy(&entry[h], &read, sizeof(read));
+    }
+    bp_tage_decide(tage, hits & ((1u << tage->tables) - 1), entry, base, pred);
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void bp_tage_predict_avx2(const bp_tage *tage, unsigned int groups, const uint16_t *entries, unsigned char base,
+                                                                       unsigned long int addr, bp_prediction *pred) {
+    unsigned long pc = addr >> 2;
+    unsigned int hashed_pc = (unsigned int)(pc ^ (pc >> tage->index_bits));
+    uint16_t entry[BP_TAGE_MAX_TABLES];
+    unsigned int hits = 0;
+    for (unsigned int g = 0; g < groups; g++) {
+        unsigned int first = g * BP_TAGE_AVX2_LANES;
+        __m256i component = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)first));
+        __m256i index = _mm256_xor_si256(_mm256_set1_epi32((int)hashed_pc), _mm256_slli_epi32(component, 1));
+        index = _mm256_xor_si256(index, _mm256_loadu_si256((const __m256i*)&tage->fold[0][first]));
+        index = _mm256_and_si256(index, _mm256_set1_epi32((int)tage->index_mask));
+        index = _mm256_or_si256(index, _mm256_loadu_si256((const __m256i*)&tage->offset[first]));
+        _mm256_storeu_si256((__m256i*)&pred->tage_index[first], index);
+        __m256i tag = _mm256_xor_si256(_mm256_set1_epi32((int)pc), _mm256_loadu_si256((const __m256i*)&tage->fold[1][first]));
+        tag = _mm256_xor_si256(tag, _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*)&tage->fold[2][first]), 1));
+        tag = _mm256_and_si256(tag, _mm256_set1_epi32((1 << BP_TAGE_TAG_BITS) - 1));
+        _mm_storeu_si128((__m128i*)&pred->tage_tag[first], _mm_packus_epi32(_mm256_castsi256_si128(tag), _mm256_extracti128_si256(tag, 1)));
+        __m256i read = _mm256_i32gather_epi32((const int*)entries, index, 2);
+        read = _mm256_and_si256(read, _mm256_set1_epi32(0xffff));
+        __m256i same = _mm256_cmpeq_epi32(_mm256_srli_epi32(read, 5), tag);
+        hits |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(same)) << first;
+        _mm_storeu_si128((__m128i*)&entry[first], _mm_packus_epi32(_mm256_castsi256_si128(read), _mm256_extracti128_si256(read, 1)));
+    }
+    bp_tage_decide(tage, hits & ((1u << tage->tables) - 1), entry, base, pred);
+}
+
+#endif
+
+ /**
+ * Updates the provider (or base) counter, the useful bits and use_alt, and on
+ * a misprediction allocates one entry in a longer-history component.
+ * Returns 1 if the base counter must be trained by the caller.
+ */
+
+static inline int bp_tage_train(bp_tage *tage, uint16_t *entries, const bp_prediction *pred, int taken) {
+    int provider = pred->tage_provider;
+    int train_base = provider < 0;
+    if (provider >= 0) {
+        uint16_t *e = &entries[pred->tage_index[provider]];
+        unsigned int ctr = BP_TAGE_CTR(*e), u = BP_TAGE_U(*e);
+        if ((ctr == 3 || ctr == 4) && pred->tage_provider_taken != pred->tage_alt_taken) {
+            int delta = pred->tage_alt_taken == taken ? 1 : -1;
+            if ((delta > 0 && tage->use_alt < BP_TAGE_USE_ALT_MAX) || (delta < 0 && tage->use_alt > -BP_TAGE_USE_ALT_MAX - 1)) tage->use_alt += delta;
+        }
+        if (pred->tage_provider_taken != pred->tage_alt_taken) {
+            if (pred->tage_provider_taken == taken) u += u < 3;
+            else u -= u > 0;
+        }
+        ctr += (taken & (ctr < 7)) - (!taken & (ctr > 0));
+        *e = BP_TAGE_ENTRY(ctr, u, BP_TAGE_TAG(*e));
+    }
+    if (pred->taken != taken && provider < (int)tage->tables - 1) {
+        int allocated = 0;
+        for (int i = provider + 1; i < (int)tage->tables; i++) {
+            uint16_t *e = &entries[pred->tage_index[i]];
+            if (BP_TAGE_U(*e) == 0) {
+                *e = BP_TAGE_ENTRY(taken ? 4 : 3, 0, pred->tage_tag[i]);
+                allocated = 1;
+                break;
+            }
+        }
+        if (!allocated) {
+            for (int i = provider + 1; i < (int)tage->tables; i++) {
+                uint16_t *e = &entries[pred->tage_index[i]];
+                *e = BP_TAGE_ENTRY(BP_TAGE_CTR(*e), BP_TAGE_U(*e) - 1, BP_TAGE_TAG(*e));
+            }
+        }
+    }
+    if (++tage->tick == BP_TAGE_RESET_PERIOD) bp_tage_age(tage, entries);
+    return train_base;
+}
+
+#endif
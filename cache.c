@@ -0,0 +1,312 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+
+#define CACHE_CHUNK (16UL << 20)
+#define CACHE_MAX_THREADS 64
+#define CACHE_SIDECAR ".xxh"
+
+ /**
+ * Result cache: the output of a run is stored under a key that hashes the
+ * trace content, the predictor configuration and the simulator binary, so
+ * an identical rerun can print it without simulating. Entries are files in
+ * one directory; a hit refreshes the file's time and inserting evicts the
+ * least recently used files beyond the size limit.
+ */
+
+static const uint64_t P1 = 11400714785074694791ULL;
+static const uint64_t P2 = 14029467366897019727ULL;
+static const uint64_t P3 = 1609587929392839161ULL;
+static const uint64_t P4 = 9650029242287828579ULL;
+static const uint64_t P5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t v) {
+    return (acc ^ hash_round(0, v)) * P1 + P4;
+}
+
+ /**
+ * XXH64 of len bytes (little-endian hosts): four independent lanes consume
+ * 32-byte stripes, then the tail and a final avalanche.
+ */
+
+uint64_t cache_hash(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char*)data, *end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; end - p >= 8; p += 8) h = rotl(h ^ hash_round(0, read64(p)), 27) * P1 + P4;
+    if (end - p >= 4) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h = rotl(h ^ (uint64_t)v * P1, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) h = rotl(h ^ *p * P5, 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+typedef struct hash_job{
+    const unsigned char *data;
+    size_t              size;
+    uint64_t            *chunks;
+    size_t              first;      /* chunks first, first + stride, ... */
+    size_t              stride;
+}hash_job;
+
+static void *hash_worker(void *arg) {
+    hash_job *job = (hash_job*)arg;
+    size_t count = (job->size + CACHE_CHUNK - 1) / CACHE_CHUNK;
+    for (size_t c = job->first; c < count; c += job->stride) {
+        size_t offset = c * CACHE_CHUNK;
+        size_t len = job->size - offset < CACHE_CHUNK ? job->size - offset : CACHE_CHUNK;
+        job->chunks[c] = cache_hash(job->data + offset, len, c);
+    }
+    return NULL;
+}
+
+ /**
+ * Hashes a mapped file as fixed 16 MiB chunks spread over the online CPUs,
+ * then hashes the list of chunk hashes. Chunking does not depend on the
+ * thread count, so every machine computes the same value.
+ */
+
+static int hash_mapped(const unsigned char *data, size_t size, uint64_t *hash) {
+    size_t count = (size + CACHE_CHUNK - 1) / CACHE_CHUNK;
+    uint64_t *chunks = (uint64_t*)calloc(count ? count : 1, sizeof(uint64_t));
+    if (!chunks) return -1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 0 ? (size_t)cpus : 1;
+    if (threads > count) threads = count ? count : 1;
+    if (threads > CACHE_MAX_THREADS) threads = CACHE_MAX_THREADS;
+    pthread_t tids[CACHE_MAX_THREADS];
+    hash_job jobs[CACHE_MAX_THREADS];
+    int started[CACHE_MAX_THREADS];
+    for (size_t t = 0; t < threads; t++) {
+        jobs[t] = (hash_job){ data, size, chunks, t, threads };
+        started[t] = t > 0 && pthread_create(&tids[t], NULL, hash_worker, &jobs[t]) == 0;
+    }
+    // Share of any worker that failed to start is hashed here instead
+    hash_worker(&jobs[0]);
+    for (size_t t = 1; t < threads; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+        else hash_worker(&jobs[t]);
+    }
+    *hash = cache_hash(chunks, count * sizeof(uint64_t), size);
+    free(chunks);
+    return 0;
+}
+
+ /**
+ * Hashes a file's content. With use_sidecar the hash is kept in
+ * "<path>.xxh" with the file's size and modification time, and reused while
+ * both still match; a sidecar that cannot be written is simply skipped.
+ * Returns 0 on success, -1 if the file cannot be read.
+ */
+
+int cache_file_hash(const char *path, int use_sidecar, uint64_t *hash) {
+    char sidecar[4096];
+    unsigned long long size, sec, nsec, value;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    snprintf(sidecar, sizeof(sidecar), "%s%s", path, CACHE_SIDECAR);
+    FILE *fp = use_sidecar ? fopen(sidecar, "r") : NULL;
+    if (fp) {
+        int fields = fscanf(fp, "%llu %llu %llu %llx", &size, &sec, &nsec, &value);
+        fclose(fp);
+        if (fields == 4 && size == (unsigned long long)st.st_size &&
+            sec == (unsigned long long)st.st_mtim.tv_sec && nsec == (unsigned long long)st.st_mtim.tv_nsec) {
+            close(fd);
+            *hash = value;
+            return 0;
+        }
+    }
+
+    const unsigned char *data = NULL;
+    if (st.st_size > 0) {
+        data = (const unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    int status = hash_mapped(data, (size_t)st.st_size, hash);
+    if (data) munmap((void*)data, st.st_size);
+    if (status == 0 && use_sidecar && (fp = fopen(sidecar, "w")) != NULL) {
+        fprintf(fp, "%llu %llu %llu %016llx\n", (unsigned long long)st.st_size, (unsigned long long)st.st_mtim.tv_sec,
+                (unsigned long long)st.st_mtim.tv_nsec, (unsigned long long)*hash);
+        fclose(fp);
+    }
+    return status;
+}
+
+ /**
+ * Hashes the first len bytes of a file the same way cache_file_hash hashes a
+ * whole one, to check that a trace still starts with what was simulated.
+ * Returns 0 on success, -1 if the file cannot be read or is shorter.
+ */
+
+int cache_prefix_hash(const char *path, size_t len, uint64_t *hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < len) {
+        close(fd);
+        return -1;
+    }
+    const unsigned char *data = NULL;
+    if (len > 0) {
+        data = (const unsigned char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    int status = hash_mapped(data, len, hash);
+    if (data) munmap((void*)data, len);
+    return status;
+}
+
+static void entry_path(char *path, size_t len, const char *dir, uint64_t key, const char *suffix) {
+    snprintf(path, len, "%s/%016llx%s", dir, (unsigned long long)key, suffix);
+}
+
+ /**
+ * Copies the cached output for key to out and marks it recently used.
+ * Returns 0 on a hit, -1 on a miss.
+ */
+
+int cache_lookup(const char *dir, uint64_t key, FILE *out) {
+    char path[4096], buf[1 << 16];
+    size_t n;
+    entry_path(path, sizeof(path), dir, key, ".out");
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) fwrite(buf, 1, n, out);
+    fclose(fp);
+    utimensat(AT_FDCWD, path, NULL, 0);
+    return 0;
+}
+
+typedef struct cache_entry{
+    char            name[32];
+    off_t           size;
+    struct timespec used;
+}cache_entry;
+
+static int older(const void *a, const void *b) {
+    const struct timespec *x = &((const cache_entry*)a)->used, *y = &((const cache_entry*)b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+ /**
+ * Deletes least recently used entries until the directory holds at most
+ * limit bytes of results.
+ */
+
+static void evict(const char *dir, unsigned long long limit) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    cache_entry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long total = 0;
+    char path[4096];
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        struct stat st;
+        if (len != 20 || strcmp(de->d_name + 16, ".out") != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            cache_entry *more = (cache_entry*)realloc(entries, capacity * sizeof(cache_entry));
+            if (!more) break;
+            entries = more;
+        }
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s", de->d_name);
+        entries[count].size = st.st_size;
+        entries[count].used = st.st_mtim;
+        total += (unsigned long long)st.st_size;
+        count++;
+    }
+    closedir(d);
+    qsort(entries, count, sizeof(cache_entry), older);
+    for (size_t i = 0; i < count && total > limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        if (unlink(path) == 0) total -= (unsigned long long)entries[i].size;
+    }
+    free(entries);
+}
+
+ /**
+ * Stores len bytes of output under key (written to a temporary file and
+ * renamed, so concurrent runs never see a partial entry), then evicts down
+ * to limit_mb MiB. Returns 0 on success, -1 if the entry cannot be written.
+ */
+
+int cache_store(const char *dir, uint64_t key, const char *data, size_t len, unsigned long int limit_mb) {
+    char tmp[4096], path[4096], suffix[32];
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+    snprintf(suffix, sizeof(suffix), ".tmp%ld", (long)getpid());
+    entry_path(tmp, sizeof(tmp), dir, key, suffix);
+    entry_path(path, sizeof(path), dir, key, ".out");
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    int ok = fwrite(data, 1, len, fp) == len;
+    ok &= fclose(fp) == 0;
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    evict(dir, (unsigned long long)limit_mb << 20);
+    return 0;
+}
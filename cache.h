@@ -0,0 +1,16 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CACHE_DEFAULT_LIMIT_MB 1024
+
+uint64_t cache_hash(const void *data, size_t len, uint64_t seed);
+int cache_file_hash(const char *path, int use_sidecar, uint64_t *hash);
+int cache_prefix_hash(const char *path, size_t len, uint64_t *hash);
+int cache_lookup(const char *dir, uint64_t key, FILE *out);
+int cache_store(const char *dir, uint64_t key, const char *data, size_t len, unsigned long int limit_mb);
+
+#endif
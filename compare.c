@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include "compare.h"
+
+#define COMPARE_INITIAL_SLOTS 4096
+#define COMPARE_MAX_PRESIZE   (1 << 20)  /* slots reserved up front at most */
+
+ /**
+ * Compare mode: two predictors run over the same chunks of the trace, and
+ * their misprediction bitmaps (from bp_batch_log) are combined here. Every
+ * branch falls in one of the four compare_case classes, counted in total and
+ * per PC in an open-addressing hash table. Branches where exactly one side
+ * was right can also be streamed in the "BPDS" format described in mlog.h.
+ */
+
+typedef struct compare_pc{
+    unsigned long int addr;
+    unsigned long int counts[COMPARE_NUM_CASES];
+    int               used;
+}compare_pc;
+
+struct compare{
+    compare_pc        *slots;
+    size_t            capacity;         /* power of two */
+    size_t            used;
+    unsigned long int totals[COMPARE_NUM_CASES];
+    uint64_t          position;         /* branches seen so far */
+    uint64_t          last;             /* position just past the last streamed branch */
+};
+
+static size_t slot_of(unsigned long int addr, size_t capacity) {
+    return (size_t)(((addr >> 2) * 0x9E3779B97F4A7C15ULL) >> 20) & (capacity - 1);
+}
+
+static int grow(compare *cmp) {
+    size_t capacity = cmp->capacity * 2;
+    compare_pc *slots = (compare_pc*)calloc(capacity, sizeof(compare_pc));
+    if (!slots) return -1;
+    for (size_t i = 0; i < cmp->capacity; i++) {
+        if (!cmp->slots[i].used) continue;
+        size_t s = slot_of(cmp->slots[i].addr, capacity);
+        while (slots[s].used) s = (s + 1) & (capacity - 1);
+        slots[s] = cmp->slots[i];
+    }
+    free(cmp->slots);
+    cmp->slots = slots;
+    cmp->capacity = capacity;
+    return 0;
+}
+
+ /**
+ * Returns the counters of addr, adding it if new, or NULL if memory is
+ * exhausted.
+ */
+
+static compare_pc *lookup(compare *cmp, unsigned long int addr) {
+    size_t s = slot_of(addr, cmp->capacity);
+    while (cmp->slots[s].used) {
+        if (cmp->slots[s].addr == addr) return &cmp->slots[s];
+        s = (s + 1) & (cmp->capacity - 1);
+    }
+    if (2 * (cmp->used + 1) > cmp->capacity) {
+        if (grow(cmp) != 0) return NULL;
+        return lookup(cmp, addr);
+    }
+    cmp->slots[s].used = 1;
+    cmp->slots[s].addr = addr;
+    cmp->used++;
+    return &cmp->slots[s];
+}
+
+ /**
+ * Creates an empty comparison with room for about pcs distinct PCs (0 if
+ * not known in advance), so a trace whose statistics state them rarely
+ * rehashes. The hint comes from a file, so it only reserves up to
+ * COMPARE_MAX_PRESIZE slots.
+ */
+
+compare *compare_create(uint64_t pcs) {
+    compare *cmp = (compare*)calloc(1, sizeof(compare));
+    if (!cmp) return NULL;
+    cmp->capacity = COMPARE_INITIAL_SLOTS;
+    while (cmp->capacity < COMPARE_MAX_PRESIZE && cmp->capacity < 2 * (pcs + 1)) cmp->capacity *= 2;
+    cmp->slots = (compare_pc*)calloc(cmp->capacity, sizeof(compare_pc));
+    if (!cmp->slots) {
+        free(cmp);
+        return NULL;
+    }
+    return cmp;
+}
+
+ /**
+ * Accounts count branches given both sides' misprediction bitmaps, and
+ * streams the disagreements if stream is not NULL.
+ * Returns 0, or -1 if memory is exhausted.
+ */
+
+int compare_chunk(compare *cmp, const unsigned long int *addrs, const uint64_t *a_mispredicted,
+                  const uint64_t *b_mispredicted, size_t count, mlog *stream) {
+    for (size_t i = 0; i < count; i++) {
+        int a_wrong = (int)(a_mispredicted[i / 64] >> (i % 64)) & 1;
+        int b_wrong = (int)(b_mispredicted[i / 64] >> (i % 64)) & 1;
+        compare_case c = a_wrong ? (b_wrong ? COMPARE_BOTH_WRONG : COMPARE_ONLY_B) :
+                                   (b_wrong ? COMPARE_ONLY_A : COMPARE_BOTH_CORRECT);
+        compare_pc *pc = lookup(cmp, addrs[i]);
+        if (!pc) return -1;
+        pc->counts[c]++;
+        cmp->totals[c]++;
+        if (stream && a_wrong != b_wrong) {
+            uint64_t position = cmp->position + i;
+            mlog_varint(stream, ((position - cmp->last) << 1) | (uint64_t)b_wrong);
+            cmp->last = position + 1;
+        }
+    }
+    cmp->position += count;
+    return 0;
+}
+
+static int more_disagreement(const void *x, const void *y) {
+    const compare_pc *a = *(const compare_pc* const*)x, *b = *(const compare_pc* const*)y;
+    unsigned long int da = a->counts[COMPARE_ONLY_A] + a->counts[COMPARE_ONLY_B];
+    unsigned long int db = b->counts[COMPARE_ONLY_A] + b->counts[COMPARE_ONLY_B];
+    if (da != db) return da > db ? -1 : 1;
+    return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+ /**
+ * Prints the four totals, then every PC on which the two sides ever
+ * disagreed, most disagreements first.
+ */
+
+void compare_print(const compare *cmp, FILE *out) {
+    fprintf(out, "AGREEMENT\n");
+    fprintf(out, "Both correct: %lu\n", cmp->totals[COMPARE_BOTH_CORRECT]);
+    fprintf(out, "Only A correct: %lu\n", cmp->totals[COMPARE_ONLY_A]);
+    fprintf(out, "Only B correct: %lu\n", cmp->totals[COMPARE_ONLY_B]);
+    fprintf(out, "Both wrong: %lu\n", cmp->totals[COMPARE_BOTH_WRONG]);
+    const compare_pc **rows = (const compare_pc**)malloc((cmp->used ? cmp->used : 1) * sizeof(compare_pc*));
+    size_t n = 0;
+    if (!rows) return;
+    for (size_t i = 0; i < cmp->capacity; i++) {
+        const compare_pc *pc = &cmp->slots[i];
+        if (pc->used && pc->counts[COMPARE_ONLY_A] + pc->counts[COMPARE_ONLY_B]) rows[n++] = pc;
+    }
+    qsort(rows, n, sizeof(rows[0]), more_disagreement);
+    fprintf(out, "DISAGREEMENTS\npc both_correct only_a only_b both_wrong\n");
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%lx %lu %lu %lu %lu\n", rows[i]->addr, rows[i]->counts[COMPARE_BOTH_CORRECT], rows[i]->counts[COMPARE_ONLY_A],
+                rows[i]->counts[COMPARE_ONLY_B], rows[i]->counts[COMPARE_BOTH_WRONG]);
+    }
+    free(rows);
+}
+
+void compare_destroy(compare *cmp) {
+    if (!cmp) return;
+    free(cmp->slots);
+    free(cmp);
+}
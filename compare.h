@@ -0,0 +1,29 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "mlog.h"
+
+ /**
+ * Outcome of one branch under two configurations A and B.
+ */
+
+typedef enum compare_case{
+    COMPARE_BOTH_CORRECT,
+    COMPARE_ONLY_A,
+    COMPARE_ONLY_B,
+    COMPARE_BOTH_WRONG,
+    COMPARE_NUM_CASES
+}compare_case;
+
+typedef struct compare compare;
+
+compare *compare_create(uint64_t pcs);
+int compare_chunk(compare *cmp, const unsigned long int *addrs, const uint64_t *a_mispredicted,
+                  const uint64_t *b_mispredicted, size_t count, mlog *stream);
+void compare_print(const compare *cmp, FILE *out);
+void compare_destroy(compare *cmp);
+
+#endif
@@ -0,0 +1,427 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "convert.h"
+#include "trace.h"
+
+ /**
+ * Conversion mode: sim --convert <output dir> <trace>...
+ *
+ * Writes every trace (text, or binary to recompress it) as a binary trace
+ * (see trace.h) named after it with a CONVERT_SUFFIX extension. Each input
+ * is cut into blocks of about TRACE_BLOCK bytes of text (or its existing
+ * blocks), and a pool of one worker per online CPU parses, encodes and
+ * compresses blocks from all traces at once: a worker takes the next block
+ * of the trace being cut, moving on to the next trace when it is used up,
+ * so both one large trace and many small ones keep every core busy.
+ *
+ * Blocks complete out of order but are written in order: a finished block
+ * waits in its trace's pending list until the ones before it have been given
+ * their place in the file, and is then written with pwrite outside the lock,
+ * so several blocks of a trace are written at the same time. At most one
+ * block per worker is ever pending. Every block is read back after writing
+ * and its checksum compared. The statistics in the header are gathered per
+ * block by the workers and combined as blocks are placed, the distinct
+ * addresses by merging each block's sorted set into the trace's. The output
+ * is written under a temporary name and renamed once complete, and removed if
+ * anything failed.
+ */
+
+#define CONVERT_SUFFIX ".bpt"
+
+typedef struct converted_block{
+    unsigned long int      seq;
+    trace_block            header;
+    trace_stats            stats;
+    trace_pcs              pcs;
+    unsigned char          *payload;
+    off_t                  offset;
+    int                    failed;
+    struct converted_block *next;
+}converted_block;
+
+typedef struct convert_trace{
+    const char        *path;
+    char              out[4096];
+    char              tmp[4096 + 32];
+    const unsigned char *data;          /* mapped input */
+    size_t            size;
+    int               binary;
+    int               fd;               /* output */
+    size_t            cursor;           /* next input byte to cut */
+    unsigned long int cut;              /* blocks handed out */
+    int               all_cut;
+    unsigned long int placed;           /* blocks given their place in the file */
+    unsigned long int written;          /* blocks written and checked */
+    off_t             end;              /* where the next placed block goes */
+    trace_stats       stats;            /* of the placed blocks */
+    trace_pcs         pcs;
+    converted_block   *pending;
+    int               failed;
+    pthread_mutex_t   lock;
+}convert_trace;
+
+typedef struct convert_job{
+    convert_trace     *traces;
+    int               count;
+    int               next;             /* trace being cut */
+    pthread_mutex_t   lock;
+}convert_job;
+
+ /**
+ * A block handed to a worker: a slice of a trace's input.
+ */
+
+typedef struct convert_chunk{
+    convert_trace     *trace;
+    unsigned long int seq;
+    const unsigned char *data;
+    size_t            size;
+}convert_chunk;
+
+ /**
+ * Maps the input and creates the temporary output with room for the header.
+ * Returns 0, or -1 if either file cannot be opened or the input is a binary
+ * trace of another version.
+ */
+
+static int open_trace(convert_trace *t, const char *dir) {
+    const char *name = strrchr(t->path, '/');
+    name = name ? name + 1 : t->path;
+    size_t stem = strlen(name);
+    const char *dot = strrchr(name, '.');
+    if (dot && dot != name) stem = (size_t)(dot - name);
+    snprintf(t->out, sizeof(t->out), "%s/%.*s" CONVERT_SUFFIX, dir, (int)stem, name);
+    snprintf(t->tmp, sizeof(t->tmp), "%s.tmp%ld", t->out, (long)getpid());
+    t->fd = -1;
+
+    int fd = open(t->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    t->size = (size_t)st.st_size;
+    if (t->size > 0) {
+        void *data = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        t->data = (const unsigned char*)data;
+        madvise(data, t->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    t->binary = t->size >= sizeof(trace_header) && memcmp(t->data, TRACE_MAGIC, 4) == 0;
+    if (t->binary && ((const trace_header*)t->data)->version != TRACE_VERSION) return -1;
+    t->cursor = t->binary ? sizeof(trace_header) : 0;
+    t->end = sizeof(trace_header);
+    t->fd = open(t->tmp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    return t->fd < 0 ? -1 : 0;
+}
+
+ /**
+ * Writes the header, closes the output and renames it into place (or
+ * removes it if anything failed), and releases the input.
+ */
+
+static void finish_trace(convert_trace *t) {
+    if (t->fd >= 0) {
+        trace_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.blocks = t->cut;
+        header.stats = t->stats;
+        header.stats.unique_pcs = t->pcs.count;
+        if (!t->failed) t->failed = pwrite(t->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+        t->failed |= close(t->fd) != 0;
+        t->fd = -1;
+        if (t->failed || rename(t->tmp, t->out) != 0) {
+            unlink(t->tmp);
+            t->failed = 1;
+        }
+    }
+    if (t->data) munmap((void*)t->data, t->size);
+    t->data = NULL;
+    trace_pcs_free(&t->pcs);
+}
+
+ /**
+ * Cuts the next block of t: the next block of text (see trace_cut), or the
+ * next stored block of a binary trace (a malformed one fails the trace and
+ * ends it). Called with t->lock held.
+ * Returns 1 if chunk was filled, 0 if t is used up.
+ */
+
+static int cut_block(convert_trace *t, convert_chunk *chunk) {
+    size_t left = t->size - t->cursor, size;
+    if (left == 0 || t->failed) return 0;
+    if (t->binary) {
+        trace_block block;
+        if (left < sizeof(block)) size = left + 1;
+        else {
+            memcpy(&block, t->data + t->cursor, sizeof(block));
+            size = sizeof(block) + (size_t)block.size;
+        }
+        if (size > left) {
+            t->failed = 1;
+            return 0;
+        }
+    }
+    else size = trace_cut((const char*)t->data + t->cursor, left);
+    chunk->trace = t;
+    chunk->seq = t->cut++;
+    chunk->data = t->data + t->cursor;
+    chunk->size = size;
+    t->cursor += size;
+    return 1;
+}
+
+ /**
+ * Hands out the next block of any trace, opening traces as the previous
+ * ones are used up. Traces that turn out empty or cannot be opened are
+ * finished right away. Returns 0 when every trace has been cut.
+ */
+
+static int next_chunk(convert_job *job, const char *dir, convert_chunk *chunk) {
+    pthread_mutex_lock(&job->lock);
+    while (job->next < job->count) {
+        convert_trace *t = &job->traces[job->next];
+        if (t->fd < 0 && !t->failed && open_trace(t, dir) != 0) t->failed = 1;
+        pthread_mutex_lock(&t->lock);
+        int found = cut_block(t, chunk);
+        int done = 0;
+        if (!found) {
+            t->all_cut = 1;
+            done = t->written == t->cut;
+        }
+        pthread_mutex_unlock(&t->lock);
+        if (found) {
+            pthread_mutex_unlock(&job->lock);
+            return 1;
+        }
+        if (done) finish_trace(t);
+        job->next++;
+    }
+    pthread_mutex_unlock(&job->lock);
+    return 0;
+}
+
+ /**
+ * Turns a chunk into a compressed block: parses the text, or inflates and
+ * checks the stored block, then gathers the statistics of the records and
+ * encodes and deflates them.
+ * Returns 0, or -1 if the input is malformed or memory is exhausted.
+ */
+
+static int build_block(const convert_chunk *chunk, converted_block *block) {
+    size_t capacity;
+    unsigned char *raw = NULL;
+    unsigned long int *addrs = NULL;
+    unsigned char *taken = NULL;
+    size_t count = (size_t)-1;
+    int ok = 0;
+
+    if (chunk->trace->binary) {
+        trace_block stored;
+        memcpy(&stored, chunk->data, sizeof(stored));
+        const unsigned char *zdata = chunk->data + sizeof(stored);
+        capacity = stored.records;
+        raw = (unsigned char*)malloc(stored.raw_size ? stored.raw_size : 1);
+        addrs = (unsigned long int*)malloc((capacity ? capacity : 1) * sizeof(unsigned long int));
+        taken = (unsigned char*)malloc(capacity ? capacity : 1);
+        uLongf length = stored.raw_size;
+        if (raw && addrs && taken && crc32(0, zdata, stored.size) == stored.crc &&
+            uncompress(raw, &length, zdata, stored.size) == Z_OK && length == stored.raw_size &&
+            crc32(0, raw, stored.raw_size) == stored.raw_crc &&
+            trace_decode(raw, stored.raw_size, stored.records, addrs, taken) == 0) count = stored.records;
+        free(raw);
+    }
+    else {
+        capacity = 1 + trace_count_lines((const char*)chunk->data, chunk->size);
+        addrs = (unsigned long int*)malloc(capacity * sizeof(unsigned long int));
+        taken = (unsigned char*)malloc(capacity);
+        if (addrs && taken) {
+            count = trace_parse((const char*)chunk->data, (const char*)chunk->data + chunk->size, addrs, taken, capacity);
+        }
+    }
+
+    if (count != (size_t)-1 && trace_pcs_add(&block->pcs, addrs, count) == 0 &&
+        (raw = (unsigned char*)malloc(TRACE_ENCODED_BOUND(count) + 1)) != NULL) {
+        trace_stats_block(&block->stats, addrs, taken, count);
+        size_t raw_size = trace_encode(addrs, taken, count, raw);
+        uLongf size = compressBound(raw_size);
+        block->payload = (unsigned char*)malloc(size);
+        if (block->payload && compress2(block->payload, &size, raw, raw_size, Z_DEFAULT_COMPRESSION) == Z_OK) {
+            block->header.records = (uint32_t)count;
+            block->header.raw_size = (uint32_t)raw_size;
+            block->header.size = (uint32_t)size;
+            block->header.raw_crc = (uint32_t)crc32(0, raw, raw_size);
+            block->header.crc = (uint32_t)crc32(0, block->payload, size);
+            ok = 1;
+        }
+        free(raw);
+    }
+    free(addrs);
+    free(taken);
+    return ok ? 0 : -1;
+}
+
+ /**
+ * Writes a placed block at its offset and reads it back to compare the
+ * checksum. Returns 0, or -1 if the data on disk does not match.
+ */
+
+static int write_block(int fd, converted_block *block) {
+    size_t size = block->header.size;
+    if (pwrite(fd, &block->header, sizeof(block->header), block->offset) != (ssize_t)sizeof(block->header) ||
+        pwrite(fd, block->payload, size, block->offset + (off_t)sizeof(block->header)) != (ssize_t)size) return -1;
+    memset(block->payload, 0, size);
+    if (pread(fd, block->payload, size, block->offset + (off_t)sizeof(block->header)) != (ssize_t)size) return -1;
+    return crc32(0, block->payload, size) == block->header.crc ? 0 : -1;
+}
+
+ /**
+ * Queues a finished block of t, places every pending block whose turn has
+ * come, writes those and finishes t after its last block.
+ */
+
+static void commit_block(convert_trace *t, converted_block *block) {
+    converted_block *ready = NULL, **tail = &ready;
+    pthread_mutex_lock(&t->lock);
+    block->next = t->pending;
+    t->pending = block;
+    for (converted_block **p = &t->pending; *p; ) {
+        converted_block *b = *p;
+        if (b->seq != t->placed) {
+            p = &b->next;
+            continue;
+        }
+        // Unlink b, place it, and rescan for its successor
+        *p = b->next;
+        b->next = NULL;
+        b->offset = t->end;
+        if (!b->failed) t->end += (off_t)(sizeof(b->header) + b->header.size);
+        trace_stats_merge(&t->stats, &b->stats);
+        b->failed |= trace_pcs_merge(&t->pcs, &b->pcs) != 0;
+        t->placed++;
+        *tail = b;
+        tail = &b->next;
+        p = &t->pending;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    while (ready) {
+        converted_block *b = ready;
+        ready = b->next;
+        int failed = b->failed || write_block(t->fd, b) != 0;
+        free(b->payload);
+        free(b);
+        pthread_mutex_lock(&t->lock);
+        t->failed |= failed;
+        t->written++;
+        int done = t->all_cut && t->written == t->cut;
+        pthread_mutex_unlock(&t->lock);
+        if (done) finish_trace(t);
+    }
+}
+
+typedef struct convert_worker{
+    convert_job       *job;
+    const char        *dir;
+}convert_worker;
+
+static void *convert_thread(void *arg) {
+    convert_worker *w = (convert_worker*)arg;
+    convert_chunk chunk;
+    for (;;) {
+        // Allocated first, so a block once cut is always committed
+        converted_block *block = (converted_block*)calloc(1, sizeof(converted_block));
+        if (!block) break;
+        if (!next_chunk(w->job, w->dir, &chunk)) {
+            free(block);
+            break;
+        }
+        block->seq = chunk.seq;
+        block->failed = build_block(&chunk, block) != 0;
+        commit_block(chunk.trace, block);
+    }
+    return NULL;
+}
+
+ /**
+ * Converts the traces at paths into dir with one worker per online CPU and
+ * prints a line per trace and the overall throughput.
+ * Returns 0 if every trace was converted, 1 otherwise.
+ */
+
+int convert_main(const char *dir, char **paths, int count) {
+    struct timeval start, stop;
+    convert_job job = { NULL, count, 0, PTHREAD_MUTEX_INITIALIZER };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (int)cpus : 1;
+    convert_worker worker = { &job, dir };
+    pthread_t *tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+    job.traces = (convert_trace*)calloc((size_t)count, sizeof(convert_trace));
+    if (!tids || !job.traces) {
+        printf("Error: Out of memory\n");
+        free(tids);
+        free(job.traces);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        job.traces[i].path = paths[i];
+        job.traces[i].fd = -1;
+        pthread_mutex_init(&job.traces[i].lock, NULL);
+    }
+
+    gettimeofday(&start, NULL);
+    int started = 0;
+    for (int i = 0; i < threads; i++) started += pthread_create(&tids[started], NULL, convert_thread, &worker) == 0;
+    if (started == 0) convert_thread(&worker);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    gettimeofday(&stop, NULL);
+
+    int converted = 0;
+    size_t input = 0;
+    for (int i = 0; i < count; i++) {
+        convert_trace *t = &job.traces[i];
+        // Workers that ran out of memory can leave a trace unfinished
+        if (i >= job.next || t->fd >= 0 || t->written != t->cut) {
+            t->failed = 1;
+            finish_trace(t);
+        }
+        while (t->pending) {
+            converted_block *b = t->pending;
+            t->pending = b->next;
+            trace_pcs_free(&b->pcs);
+            free(b->payload);
+            free(b);
+        }
+        pthread_mutex_destroy(&t->lock);
+        if (t->failed) {
+            printf("Error: Unable to convert %s\n", t->path);
+            continue;
+        }
+        printf("CONVERTED %s %s %llu records %lu blocks %zu -> %llu bytes\n", t->path, t->out,
+               (unsigned long long)t->stats.records, t->cut, t->size, (unsigned long long)t->end);
+        converted++;
+        input += t->size;
+    }
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+    printf("Converted %d of %d traces with %d threads in %.2f s (%.1f MB/s of input)\n", converted, count,
+           started ? started : 1, seconds, seconds > 0 ? input / seconds / 1e6 : 0.0);
+    free(tids);
+    free(job.traces);
+    return converted == count ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mlog.h"
+
+#define MLOG_BUFFER (1UL << 20)
+#define MLOG_BUFFERS 4
+#define MLOG_VARINT_MAX 10
+
+ /**
+ * The simulation encodes into one buffer while a writer thread flushes the
+ * ones already filled, so output never stalls the predictor unless the disk
+ * falls MLOG_BUFFERS buffers behind.
+ */
+
+struct mlog{
+    FILE              *fp;
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    unsigned char     *buffers[MLOG_BUFFERS];
+    size_t            lengths[MLOG_BUFFERS];
+    unsigned long int head;             /* next buffer to write out */
+    unsigned long int tail;             /* buffer being filled */
+    int               done;
+    int               failed;
+    int               bit;              /* value of the current run: 1 = mispredicted */
+    uint64_t          run;
+};
+
+static void *writer_thread(void *arg) {
+    mlog *log = (mlog*)arg;
+    pthread_mutex_lock(&log->lock);
+    for (;;) {
+        while (log->head == log->tail && !log->done) pthread_cond_wait(&log->cond, &log->lock);
+        if (log->head == log->tail) break;
+        unsigned long int slot = log->head % MLOG_BUFFERS;
+        pthread_mutex_unlock(&log->lock);
+        // The buffer at head belongs to the writer until head moves past it
+        int ok = fwrite(log->buffers[slot], 1, log->lengths[slot], log->fp) == log->lengths[slot];
+        pthread_mutex_lock(&log->lock);
+        log->failed |= !ok;
+        log->head++;
+        pthread_cond_signal(&log->cond);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+ /**
+ * Hands the buffer being filled to the writer and waits for a free one.
+ */
+
+static void publish(mlog *log) {
+    pthread_mutex_lock(&log->lock);
+    log->tail++;
+    pthread_cond_signal(&log->cond);
+    while (log->tail - log->head == MLOG_BUFFERS) pthread_cond_wait(&log->cond, &log->lock);
+    log->lengths[log->tail % MLOG_BUFFERS] = 0;
+    pthread_mutex_unlock(&log->lock);
+}
+
+ /**
+ * Creates path with a header carrying magic and record_size and starts the
+ * writer. Returns NULL if the file cannot be created or memory is exhausted.
+ */
+
+mlog *mlog_open(const char *path, const char *magic, uint32_t record_size) {
+    mlog *log = (mlog*)calloc(1, sizeof(mlog));
+    if (!log) return NULL;
+    for (int i = 0; i < MLOG_BUFFERS; i++) {
+        log->buffers[i] = (unsigned char*)malloc(MLOG_BUFFER);
+        if (!log->buffers[i]) {
+            for (int j = 0; j < i; j++) free(log->buffers[j]);
+            free(log);
+            return NULL;
+        }
+    }
+    log->fp = fopen(path, "wb");
+    if (!log->fp) {
+        for (int i = 0; i < MLOG_BUFFERS; i++) free(log->buffers[i]);
+        free(log);
+        return NULL;
+    }
+    mlog_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = MLOG_VERSION;
+    header.record_size = record_size;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->cond, NULL);
+    mlog_write(log, &header, sizeof(header));
+    pthread_create(&log->thread, NULL, writer_thread, log);
+    return log;
+}
+
+ /**
+ * Appends len raw bytes.
+ */
+
+void mlog_write(mlog *log, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    while (len > 0) {
+        unsigned long int slot = log->tail % MLOG_BUFFERS;
+        size_t room = MLOG_BUFFER - log->lengths[slot];
+        size_t n = len < room ? len : room;
+        memcpy(log->buffers[slot] + log->lengths[slot], p, n);
+        log->lengths[slot] += n;
+        p += n;
+        len -= n;
+        if (log->lengths[slot] == MLOG_BUFFER) publish(log);
+    }
+}
+
+ /**
+ * Appends value as an LEB128 varint.
+ */
+
+void mlog_varint(mlog *log, uint64_t value) {
+    unsigned char bytes[MLOG_VARINT_MAX];
+    size_t n = 0;
+    do {
+        bytes[n] = (unsigned char)(value & 0x7f);
+        value >>= 7;
+        bytes[n++] |= value ? 0x80 : 0;
+    } while (value);
+    mlog_write(log, bytes, n);
+}
+
+ /**
+ * Appends count branch outcomes, branch i mispredicted if bit i % 64 of
+ * mispredicted[i / 64] is set (the layout bp_batch_log produces). Whole runs
+ * are found with a count of trailing zeros, so long correct stretches cost
+ * one step per word.
+ */
+
+void mlog_bits(mlog *log, const uint64_t *mispredicted, size_t count) {
+    for (size_t word = 0; word * 64 < count; word++) {
+        unsigned int valid = count - word * 64 < 64 ? (unsigned int)(count - word * 64) : 64;
+        unsigned int pos = 0;
+        while (pos < valid) {
+            // Set bits of x mark where the current run ends
+            uint64_t x = (log->bit ? ~mispredicted[word] : mispredicted[word]) >> pos;
+            if (valid - pos < 64) x &= (1ULL << (valid - pos)) - 1;
+            if (x == 0) {
+                log->run += valid - pos;
+                break;
+            }
+            unsigned int length = (unsigned int)__builtin_ctzll(x);
+            mlog_varint(log, log->run + length);
+            log->run = 0;
+            log->bit ^= 1;
+            pos += length;
+        }
+    }
+}
+
+ /**
+ * Ends the run in progress, flushes everything and closes the file.
+ * Returns 0 on success, -1 if anything could not be written.
+ */
+
+int mlog_close(mlog *log) {
+    if (log->run) mlog_varint(log, log->run);
+    pthread_mutex_lock(&log->lock);
+    if (log->lengths[log->tail % MLOG_BUFFERS]) log->tail++;
+    log->done = 1;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->thread, NULL);
+    int failed = log->failed;
+    failed |= fclose(log->fp) != 0;
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->cond);
+    for (int i = 0; i < MLOG_BUFFERS; i++) free(log->buffers[i]);
+    free(log);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef MLOG_H
+#define MLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+ /**
+ * Per-branch output files. Both start with an mlog_header.
+ * - Misprediction log ("BPML", record_size 0): one bit per dynamic branch,
+ *   run-length encoded as LEB128 varints. Runs alternate between correctly
+ *   predicted and mispredicted branches, starting with a (possibly empty)
+ *   correct run; the runs add up to the number of branches.
+ * - Annotated trace ("BPAT"): one mlog_record per dynamic branch.
+ * - Disagreement stream ("BPDS", record_size 0): in compare mode, one LEB128
+ *   varint per dynamic branch that exactly one configuration predicted
+ *   correctly, holding (gap << 1) | a, where gap counts the branches since
+ *   the previous such branch and a is 1 if configuration A was the right one.
+ * - Undo log ("BPUL"): table deltas and snapshots, described in undo.c.
+ */
+
+#define MLOG_VERSION 1
+
+#define MLOG_CONFIDENT     0x01         /* the deciding counter was saturated */
+#define MLOG_LOOP_OVERRIDE 0x02         /* the loop predictor replaced the direction */
+
+typedef struct mlog_header{
+    char     magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+}mlog_header;
+
+typedef struct mlog_record{
+    uint64_t addr;
+    uint8_t  taken;
+    uint8_t  predicted;
+    uint8_t  provider;                  /* bp_table_id of the table that decided */
+    int8_t   tage_provider;             /* TAGE tagged component, -1 for the base or other types */
+    uint8_t  flags;
+    uint8_t  reserved[3];
+}mlog_record;
+
+typedef struct mlog mlog;
+
+mlog *mlog_open(const char *path, const char *magic, uint32_t record_size);
+void mlog_bits(mlog *log, const uint64_t *mispredicted, size_t count);
+void mlog_write(mlog *log, const void *data, size_t len);
+void mlog_varint(mlog *log, uint64_t value);
+int mlog_close(mlog *log);
+
+#endif
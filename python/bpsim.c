@@ -0,0 +1,309 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string.h>
+#include "../bp.h"
+
+ /**
+ * bpsim: CPython bindings for libbp.
+ *
+ *   p = bpsim.Predictor("gshare", M1=9, N=3)
+ *   p.batch(addrs, taken)          # any buffers, e.g. NumPy uint64 / uint8 arrays
+ *   p.stats                        # {"predictions": ..., "mispredictions": ...}
+ *   np.asarray(p.table("gshare"))  # zero-copy view of the live counter table
+ *
+ * Tables export their entries with the type the predictor stores them in
+ * (int8 perceptron weights, uint16 TAGE entries, uint64 loop entries, bytes
+ * otherwise), so NumPy sees the values rather than their bytes.
+ *
+ * batch() reads the caller's buffers in place through the buffer protocol and
+ * releases the GIL while the kernel runs, so several predictors can be
+ * simulated from different Python threads at once. A predictor refuses to
+ * be used by two threads at the same time instead of racing.
+ */
+
+typedef struct{
+    PyObject_HEAD
+    bp_predictor *bp;
+    int          busy;
+}PredictorObject;
+
+typedef struct{
+    PyObject_HEAD
+    PredictorObject *owner;
+    bp_table_id     id;
+    Py_ssize_t      shape[1];           /* filled for each exported buffer */
+    Py_ssize_t      strides[1];
+}TableObject;
+
+static PyTypeObject PredictorType;
+static PyTypeObject TableType;
+
+static int predictor_acquire(PredictorObject *self) {
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "predictor is in use by another thread");
+        return -1;
+    }
+    self->busy = 1;
+    return 0;
+}
+
+static PyObject *predictor_wrap(bp_predictor *bp) {
+    PredictorObject *self = PyObject_New(PredictorObject, &PredictorType);
+    if (!self) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    self->bp = bp;
+    self->busy = 0;
+    return (PyObject*)self;
+}
+
+static PyObject *Predictor_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "name", "K", "M1", "N", "M2", "P", "H", "theta", "T", "B", "Lmin", "Lmax", "L", "S", "E", "first", "second", "policy",
+                              "isa", NULL };
+    const char *name;
+    const char *first = NULL, *second = NULL, *policy = NULL, *isa = NULL;
+    bp_config config;
+    memset(&config, 0, sizeof(config));
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|kkkkkklkkkkkkkssss", kwlist, &name, &config.K, &config.M1, &config.N, &config.M2,
+                                     &config.P, &config.H, &config.theta, &config.T, &config.B, &config.Lmin, &config.Lmax,
+                                     &config.L, &config.S, &config.E, &first, &second, &policy, &isa))
+        return NULL;
+    if (bp_type_from_name(name, &config.type) != 0) {
+        PyErr_Format(PyExc_ValueError, "unknown predictor: %s", name);
+        return NULL;
+    }
+    const char *unknown = NULL;
+    if (first && bp_type_from_name(first, &config.first) != 0) unknown = first;
+    else if (second && bp_type_from_name(second, &config.second) != 0) unknown = second;
+    if (unknown) {
+        PyErr_Format(PyExc_ValueError, "unknown tournament component: %s", unknown);
+        return NULL;
+    }
+    if (policy && bp_policy_from_name(policy, &config.policy) != 0) {
+        PyErr_Format(PyExc_ValueError, "unknown update policy: %s", policy);
+        return NULL;
+    }
+    if (isa && bp_isa_from_name(isa, &config.isa) != 0) {
+        PyErr_Format(PyExc_ValueError, "unknown instruction set: %s", isa);
+        return NULL;
+    }
+    if (!bp_isa_supported(config.isa)) {
+        PyErr_Format(PyExc_ValueError, "instruction set not supported by this CPU: %s", isa);
+        return NULL;
+    }
+    bp_predictor *bp = bp_create(&config);
+    if (!bp) {
+        PyErr_Format(PyExc_ValueError, "invalid %s configuration", name);
+        return NULL;
+    }
+    return predictor_wrap(bp);
+}
+
+static void Predictor_dealloc(PredictorObject *self) {
+    bp_destroy(self->bp);
+    PyObject_Del(self);
+}
+
+static PyObject *Predictor_step(PredictorObject *self, PyObject *args) {
+    unsigned long int addr;
+    int taken;
+    if (!PyArg_ParseTuple(args, "kp", &addr, &taken)) return NULL;
+    if (predictor_acquire(self) != 0) return NULL;
+    int correct = bp_step(self->bp, addr, taken);
+    self->busy = 0;
+    return PyBool_FromLong(correct);
+}
+
+ /**
+ * batch(addrs, taken) -> mispredictions in this batch.
+ * addrs must be a contiguous buffer of native unsigned longs (NumPy uint64)
+ * and taken a contiguous byte buffer (uint8 or bool) of the same length.
+ */
+
+static PyObject *Predictor_batch(PredictorObject *self, PyObject *args) {
+    PyObject *addrs_obj, *taken_obj;
+    Py_buffer addrs, taken;
+    if (!PyArg_ParseTuple(args, "OO", &addrs_obj, &taken_obj)) return NULL;
+    if (PyObject_GetBuffer(addrs_obj, &addrs, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) return NULL;
+    if (PyObject_GetBuffer(taken_obj, &taken, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+        PyBuffer_Release(&addrs);
+        return NULL;
+    }
+    PyObject *result = NULL;
+    if (addrs.itemsize != sizeof(unsigned long int) || !strchr("LQ", addrs.format ? addrs.format[strlen(addrs.format) - 1] : 'B')) {
+        PyErr_SetString(PyExc_TypeError, "addrs must be a contiguous uint64 buffer");
+    } else if (taken.itemsize != 1) {
+        PyErr_SetString(PyExc_TypeError, "taken must be a contiguous uint8 or bool buffer");
+    } else if (addrs.len / addrs.itemsize != taken.len) {
+        PyErr_SetString(PyExc_ValueError, "addrs and taken differ in length");
+    } else if (predictor_acquire(self) == 0) {
+        unsigned long int mispredictions;
+        Py_BEGIN_ALLOW_THREADS
+        mispredictions = bp_batch(self->bp, (const unsigned long int*)addrs.buf, (const unsigned char*)taken.buf, (size_t)taken.len);
+        Py_END_ALLOW_THREADS
+        self->busy = 0;
+        result = PyLong_FromUnsignedLong(mispredictions);
+    }
+    PyBuffer_Release(&addrs);
+    PyBuffer_Release(&taken);
+    return result;
+}
+
+static PyObject *Predictor_reset(PredictorObject *self, PyObject *unused) {
+    if (predictor_acquire(self) != 0) return NULL;
+    bp_reset(self->bp);
+    self->busy = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject *Predictor_snapshot(PredictorObject *self, PyObject *unused) {
+    if (predictor_acquire(self) != 0) return NULL;
+    bp_predictor *copy = bp_snapshot(self->bp);
+    self->busy = 0;
+    if (!copy) return PyErr_NoMemory();
+    return predictor_wrap(copy);
+}
+
+ /**
+ * table(name) -> typed buffer over the live table ("chooser", "gshare", "bimodal",
+ * "perceptron" with 64 int8 weights per row, "tage" with uint16 entries,
+ * "local_history" with packed H-bit histories, "local", or "loop" with uint64
+ * entries).
+ * The buffer keeps the predictor alive and reflects later simulation.
+ */
+
+static PyObject *Predictor_table(PredictorObject *self, PyObject *args) {
+    const char *name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        if (strcmp(name, bp_table_name((bp_table_id)t)) != 0) continue;
+        if (!bp_table(self->bp, (bp_table_id)t, NULL)) break;
+        TableObject *table = PyObject_New(TableObject, &TableType);
+        if (!table) return NULL;
+        Py_INCREF(self);
+        table->owner = self;
+        table->id = (bp_table_id)t;
+        return (PyObject*)table;
+    }
+    PyErr_Format(PyExc_KeyError, "predictor has no %s table", name);
+    return NULL;
+}
+
+static PyObject *Predictor_get_stats(PredictorObject *self, void *closure) {
+    bp_stats stats;
+    bp_get_stats(self->bp, &stats);
+    return Py_BuildValue("{s:k,s:k}", "predictions", stats.predictions, "mispredictions", stats.mispredictions);
+}
+
+static PyMethodDef Predictor_methods[] = {
+    { "step", (PyCFunction)Predictor_step, METH_VARARGS, "step(addr, taken) -> True if predicted correctly" },
+    { "batch", (PyCFunction)Predictor_batch, METH_VARARGS, "batch(addrs, taken) -> mispredictions in the batch" },
+    { "reset", (PyCFunction)Predictor_reset, METH_NOARGS, "restore initial tables and clear statistics" },
+    { "snapshot", (PyCFunction)Predictor_snapshot, METH_NOARGS, "independent copy of the predictor" },
+    { "table", (PyCFunction)Predictor_table, METH_VARARGS, "table(name) -> zero-copy buffer of a counter table" },
+    { NULL }
+};
+
+static PyGetSetDef Predictor_getset[] = {
+    { "stats", (getter)Predictor_get_stats, NULL, "prediction statistics", NULL },
+    { NULL }
+};
+
+static PyTypeObject PredictorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "bpsim.Predictor",
+    .tp_basicsize = sizeof(PredictorObject),
+    .tp_dealloc = (destructor)Predictor_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Predictor(name, K=0, M1=0, N=0, M2=0, P=0, H=0, theta=0, T=0, B=0, Lmin=0, Lmax=0, L=0, S=0, E=0, first=None, second=None, policy=None, isa=None)",
+    .tp_methods = Predictor_methods,
+    .tp_getset = Predictor_getset,
+    .tp_new = Predictor_new,
+};
+
+ /**
+ * Returns the struct module format of one entry of table id, the same widths
+ * the server prints (sb_table in server.c).
+ */
+
+static const char *table_format(bp_table_id id) {
+    return id == BP_TABLE_PERCEPTRON ? "b" : id == BP_TABLE_TAGE ? "H" : id == BP_TABLE_LOOP ? "Q" : "B";
+}
+
+static Py_ssize_t table_itemsize(bp_table_id id) {
+    return id == BP_TABLE_TAGE ? (Py_ssize_t)sizeof(uint16_t) : id == BP_TABLE_LOOP ? (Py_ssize_t)sizeof(uint64_t) : 1;
+}
+
+static int Table_getbuffer(TableObject *self, Py_buffer *view, int flags) {
+    size_t size;
+    const unsigned char *data = bp_table(self->owner->bp, self->id, &size);
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "predictor tables are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+    Py_ssize_t itemsize = table_itemsize(self->id);
+    self->shape[0] = (Py_ssize_t)size / itemsize;
+    self->strides[0] = itemsize;
+    view->buf = (void*)data;
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->len = self->shape[0] * itemsize;
+    view->readonly = 1;
+    view->itemsize = itemsize;
+    view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? (char*)table_format(self->id) : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void Table_dealloc(TableObject *self) {
+    Py_DECREF(self->owner);
+    PyObject_Del(self);
+}
+
+static Py_ssize_t Table_length(TableObject *self) {
+    size_t size;
+    bp_table(self->owner->bp, self->id, &size);
+    return (Py_ssize_t)size / table_itemsize(self->id);
+}
+
+static PyBufferProcs Table_as_buffer = {
+    (getbufferproc)Table_getbuffer,
+    NULL,
+};
+
+static PySequenceMethods Table_as_sequence = {
+    .sq_length = (lenfunc)Table_length,
+};
+
+static PyTypeObject TableType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "bpsim.Table",
+    .tp_basicsize = sizeof(TableObject),
+    .tp_dealloc = (destructor)Table_dealloc,
+    .tp_as_sequence = &Table_as_sequence,
+    .tp_as_buffer = &Table_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "read-only buffer over a predictor table, one item per entry",
+};
+
+static struct PyModuleDef bpsim_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "bpsim",
+    .m_doc = "Zero-copy bindings for the libbp branch predictors",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_bpsim(void) {
+    if (PyType_Ready(&PredictorType) < 0 || PyType_Ready(&TableType) < 0) return NULL;
+    PyObject *m = PyModule_Create(&bpsim_module);
+    if (!m) return NULL;
+    Py_INCREF(&PredictorType);
+    PyModule_AddObject(m, "Predictor", (PyObject*)&PredictorType);
+    return m;
+}
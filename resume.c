@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bp.h"
+#include "cache.h"
+#include "resume.h"
+
+#define RESUME_MAGIC 0x4d535242u       /* "BRSM" */
+
+ /**
+ * Incremental re-simulation of a trace that only ever grows. After a run the
+ * state file records how far into the trace it got (a byte offset at a line
+ * boundary), a hash of that prefix, a key for the configuration and the full
+ * state of every predictor. The next run continues from there when the
+ * configuration is the same and the trace still starts with the same bytes,
+ * so only the appended records are simulated.
+ */
+
+typedef struct resume_header{
+    uint32_t magic;
+    uint32_t predictors;
+    uint64_t key;                      /* configuration */
+    uint64_t offset;                   /* trace bytes already simulated */
+    uint64_t prefix_hash;              /* cache_prefix_hash of those bytes */
+}resume_header;
+
+ /**
+ * Replaces bps[0..nbps-1] with the predictors stored in state_path and sets
+ * *offset to where the trace continues, if the state matches key and the
+ * trace's current prefix. Otherwise bps is left alone and *offset is 0.
+ * Returns 1 if the state was restored, 0 if there is no state file yet, or -1
+ * if the state was discarded (another configuration, a rewritten trace, or a
+ * file written by another build of libbp).
+ */
+
+int resume_load(const char *state_path, const char *trace_path, uint64_t key, bp_predictor **bps, int nbps, size_t *offset) {
+    resume_header header;
+    uint64_t prefix_hash;
+    bp_predictor *loaded[BP_NUM_POLICIES];
+    int count = 0;
+    *offset = 0;
+    FILE *fp = fopen(state_path, "rb");
+    if (!fp) return 0;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != RESUME_MAGIC || header.key != key ||
+        header.predictors != (uint32_t)nbps || nbps > BP_NUM_POLICIES ||
+        cache_prefix_hash(trace_path, header.offset, &prefix_hash) != 0 || prefix_hash != header.prefix_hash) {
+        fclose(fp);
+        return -1;
+    }
+    while (count < nbps && (loaded[count] = bp_load(fp)) != NULL) count++;
+    fclose(fp);
+    if (count < nbps) {
+        for (int i = 0; i < count; i++) bp_destroy(loaded[i]);
+        return -1;
+    }
+    for (int i = 0; i < nbps; i++) {
+        bp_destroy(bps[i]);
+        bps[i] = loaded[i];
+    }
+    *offset = header.offset;
+    return 1;
+}
+
+ /**
+ * Records the predictors after simulating the first offset bytes of the
+ * trace. The file is written under a temporary name and renamed, so an
+ * interrupted run leaves the previous state intact.
+ * Returns 0 on success, -1 if the trace or the state file cannot be accessed.
+ */
+
+int resume_save(const char *state_path, const char *trace_path, uint64_t key, bp_predictor *const *bps, int nbps, size_t offset) {
+    resume_header header = { RESUME_MAGIC, (uint32_t)nbps, key, offset, 0 };
+    char tmp[4096];
+    if (cache_prefix_hash(trace_path, offset, &header.prefix_hash) != 0) return -1;
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld", state_path, (long)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (int i = 0; i < nbps && ok; i++) ok = bp_save(bps[i], fp) == 0;
+    ok &= fclose(fp) == 0;
+    if (!ok || rename(tmp, state_path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
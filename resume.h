@@ -0,0 +1,11 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bp.h"
+
+int resume_load(const char *state_path, const char *trace_path, uint64_t key, bp_predictor **bps, int nbps, size_t *offset);
+int resume_save(const char *state_path, const char *trace_path, uint64_t key, bp_predictor *const *bps, int nbps, size_t offset);
+
+#endif
@@ -0,0 +1,763 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "bp.h"
+#include "server.h"
+#include "topology.h"
+#include "trace.h"
+
+ /**
+ * Daemon mode: sim --server <socket> [workers [memory MiB]]
+ *
+ * Clients connect to a Unix domain socket and send one JSON object per line:
+ *   {"id": 7, "trace": "gcc_trace.txt", "predictor": "gshare", "M1": 9, "N": 3}
+ * Optional keys are K, M1, N, M2, P, H, theta, T, B, Lmin, Lmax, L, S and E
+ * (as on the command line), "first" and "second" (tournament component
+ * names), "policy" (hybrid/tournament update policy name) and "contents":
+ * true to also return the final tables. Each request becomes a job on a
+ * shared worker pool, and each result is written back as one JSON line as
+ * soon as it finishes, so requests on one connection may complete out of
+ * order ("id" is echoed to match them up). Parsed traces are cached across
+ * requests and reloaded only when the file's size or modification time
+ * changes.
+ *
+ * On a machine with several NUMA nodes the workers are spread over the nodes
+ * and pinned to cores. Each worker creates its predictor, so the tables are
+ * first touched and therefore allocated on its own node, and it reads a
+ * replica of the parsed trace made on its node the first time that node
+ * needs the trace, so simulation never reads across the interconnect.
+ *
+ * Jobs are admitted against a memory budget (three quarters of physical
+ * memory by default). A job's cost is its predictor's footprint plus the
+ * trace buffers it may have to load or replicate (exact for a binary trace,
+ * whose header gives the record count), and the cached traces count against
+ * the budget too. Once a job's trace is loaded, its buffers count only as
+ * cached. A worker takes the oldest queued job that fits in what is left, so
+ * small jobs fill the slack beside a large one, but a job passed over
+ * SERVER_MAX_BYPASS times holds back everything queued behind it until memory
+ * frees up. Unused cached traces are dropped when a job does not fit, and a
+ * job larger than the whole budget is refused.
+ */
+
+#define SERVER_MAX_LINE   4096
+#define SERVER_MAX_FIELDS 16
+#define SERVER_BACKLOG    64
+#define SERVER_MAX_BYPASS 32
+
+typedef struct json_field{
+    char key[32];
+    char value[SERVER_MAX_LINE];
+    int  is_string;
+}json_field;
+
+enum { REPLICA_NONE, REPLICA_COPYING, REPLICA_READY, REPLICA_FAILED };
+
+typedef struct cached_trace{
+    char                *path;
+    off_t               size;
+    struct timespec     mtime;
+    bp_trace            trace;
+    int                 home;                               /* node the trace was loaded on */
+    bp_trace            replica[TOPOLOGY_MAX_NODES];        /* copies for the other nodes */
+    int                 replica_state[TOPOLOGY_MAX_NODES];
+    int                 loading;
+    int                 failed;
+    int                 stale;
+    int                 refs;
+    struct cached_trace *next;
+}cached_trace;
+
+typedef struct connection{
+    int             fd;
+    int             refs;
+    pthread_mutex_t write_lock;
+}connection;
+
+typedef struct job{
+    connection      *conn;
+    char            *request;
+    size_t          footprint;      /* predictor bytes, 0 for a request that will fail */
+    char            *path;          /* trace to load, NULL if none */
+    off_t           size;           /* trace size and time when queued, size -1 if missing */
+    struct timespec mtime;
+    uint64_t        records;        /* from a binary trace's header, 0 if unknown */
+    struct cached_trace *pinned;    /* cached trace referenced at admission, not charged again */
+    size_t          cost;           /* bytes reserved while running */
+    int             bypassed;       /* later jobs admitted ahead of this one */
+    int             too_large;
+    struct job      *next;
+}job;
+
+typedef struct server{
+    pthread_mutex_t lock;
+    pthread_cond_t  job_ready;
+    pthread_cond_t  trace_ready;
+    job             *head;
+    job             *tail;
+    cached_trace    *traces;
+    topology        topo;
+    size_t          budget;         /* bytes */
+    size_t          reserved;       /* costs of the running jobs */
+    size_t          cached;         /* bytes held by loaded traces and replicas */
+}server;
+
+typedef struct worker_args{
+    server *srv;
+    int    index;
+}worker_args;
+
+typedef struct reader_args{
+    server     *srv;
+    connection *conn;
+}reader_args;
+
+typedef struct strbuf{
+    char   *data;
+    size_t len;
+    size_t cap;
+}strbuf;
+
+static void sb_printf(strbuf *sb, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->data ? sb->data + sb->len : NULL, sb->data ? sb->cap - sb->len : 0, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && sb->data && sb->len + n < sb->cap) {
+            sb->len += n;
+            return;
+        }
+        size_t cap = sb->cap ? sb->cap * 2 : 256;
+        while (cap < sb->len + n + 1) cap *= 2;
+        sb->data = (char*)realloc(sb->data, cap);
+        sb->cap = cap;
+    }
+}
+
+static void sb_json_string(strbuf *sb, const char *s) {
+    sb_printf(sb, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') sb_printf(sb, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) sb_printf(sb, "\\u%04x", *s);
+        else sb_printf(sb, "%c", *s);
+    }
+    sb_printf(sb, "\"");
+}
+
+ /**
+ * Parses a flat JSON object (string, number and literal values only).
+ * Returns the number of fields, or -1 if the line is not such an object.
+ */
+
+static int json_parse_flat(const char *p, json_field *fields, int max) {
+    int n = 0;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p++ != '{') return -1;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '}') return n;
+        if (*p++ != '"' || n == max) return -1;
+        json_field *f = &fields[n];
+        size_t k = 0;
+        while (*p && *p != '"' && k < sizeof(f->key) - 1) f->key[k++] = *p++;
+        f->key[k] = '\0';
+        if (*p++ != '"') return -1;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p++ != ':') return -1;
+        while (*p == ' ' || *p == '\t') p++;
+        size_t v = 0;
+        f->is_string = *p == '"';
+        if (f->is_string) {
+            p++;
+            while (*p && *p != '"' && v < sizeof(f->value) - 1) {
+                if (*p == '\\' && p[1]) p++;
+                f->value[v++] = *p++;
+            }
+            if (*p++ != '"') return -1;
+        } else {
+            while (*p && *p != ',' && *p != '}' && *p != ' ' && v < sizeof(f->value) - 1) f->value[v++] = *p++;
+            if (v == 0) return -1;
+        }
+        f->value[v] = '\0';
+        n++;
+    }
+}
+
+static const json_field *json_find(const json_field *fields, int n, const char *key) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(fields[i].key, key) == 0) return &fields[i];
+    }
+    return NULL;
+}
+
+static void connection_release(server *srv, connection *conn) {
+    pthread_mutex_lock(&srv->lock);
+    int last = --conn->refs == 0;
+    pthread_mutex_unlock(&srv->lock);
+    if (last) {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->write_lock);
+        free(conn);
+    }
+}
+
+static void connection_send(connection *conn, const char *data, size_t len) {
+    pthread_mutex_lock(&conn->write_lock);
+    while (len > 0) {
+        ssize_t w = write(conn->fd, data, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        data += w;
+        len -= w;
+    }
+    pthread_mutex_unlock(&conn->write_lock);
+}
+
+static void cached_trace_free(cached_trace *ct) {
+    trace_free(&ct->trace);
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+        if (ct->replica_state[node] == REPLICA_READY) trace_free(&ct->replica[node]);
+    }
+    free(ct->path);
+    free(ct);
+}
+
+static size_t cached_bytes(const cached_trace *ct) {
+    size_t bytes = ct->trace.map_size;
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+        if (ct->replica_state[node] == REPLICA_READY) bytes += ct->replica[node].map_size;
+    }
+    return bytes;
+}
+
+static void trace_release(server *srv, cached_trace *ct) {
+    pthread_mutex_lock(&srv->lock);
+    int drop = --ct->refs == 0 && ct->stale;
+    if (drop) srv->cached -= cached_bytes(ct);
+    pthread_mutex_unlock(&srv->lock);
+    if (drop) cached_trace_free(ct);
+}
+
+ /**
+ * Returns a referenced, fully loaded cache entry for path, loading it if needed
+ * (by a worker on node, which becomes the trace's home node).
+ * Concurrent requests for the same trace wait for a single load.
+ * Returns NULL if the trace cannot be read.
+ */
+
+static cached_trace *trace_acquire(server *srv, const char *path, int node) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+    pthread_mutex_lock(&srv->lock);
+    cached_trace **link = &srv->traces;
+    cached_trace *ct;
+    while ((ct = *link) != NULL) {
+        if (strcmp(ct->path, path) == 0) {
+            if (ct->size == st.st_size && ct->mtime.tv_sec == st.st_mtim.tv_sec &&
+                ct->mtime.tv_nsec == st.st_mtim.tv_nsec && !ct->failed) break;
+            *link = ct->next;
+            ct->stale = 1;
+            if (ct->refs == 0 && !ct->loading) {
+                srv->cached -= cached_bytes(ct);
+                cached_trace_free(ct);
+            }
+            continue;
+        }
+        link = &ct->next;
+    }
+    if (ct) {
+        ct->refs++;
+        while (ct->loading) pthread_cond_wait(&srv->trace_ready, &srv->lock);
+    } else {
+        ct = (cached_trace*)calloc(1, sizeof(cached_trace));
+        if (ct && (ct->path = strdup(path)) == NULL) {
+            free(ct);
+            ct = NULL;
+        }
+        if (!ct) {
+            pthread_mutex_unlock(&srv->lock);
+            return NULL;
+        }
+        ct->size = st.st_size;
+        ct->mtime = st.st_mtim;
+        ct->home = node;
+        ct->loading = 1;
+        ct->refs = 1;
+        ct->next = srv->traces;
+        srv->traces = ct;
+        pthread_mutex_unlock(&srv->lock);
+        int failed = trace_load(path, &ct->trace) != 0;
+        pthread_mutex_lock(&srv->lock);
+        ct->failed = failed;
+        ct->loading = 0;
+        srv->cached += ct->trace.map_size;
+        pthread_cond_broadcast(&srv->trace_ready);
+    }
+    int failed = ct->failed;
+    pthread_mutex_unlock(&srv->lock);
+    if (failed) {
+        trace_release(srv, ct);
+        return NULL;
+    }
+    return ct;
+}
+
+ /**
+ * Returns the copy of a referenced trace that lives on node, making it on
+ * the first request from that node (other workers of the node wait for it).
+ * Falls back to the home copy if the replica cannot be allocated.
+ */
+
+static const bp_trace *trace_local(server *srv, cached_trace *ct, int node) {
+    if (node == ct->home) return &ct->trace;
+    pthread_mutex_lock(&srv->lock);
+    while (ct->replica_state[node] == REPLICA_COPYING) pthread_cond_wait(&srv->trace_ready, &srv->lock);
+    if (ct->replica_state[node] == REPLICA_NONE) {
+        ct->replica_state[node] = REPLICA_COPYING;
+        pthread_mutex_unlock(&srv->lock);
+        int failed = trace_copy(&ct->trace, &ct->replica[node]) != 0;
+        pthread_mutex_lock(&srv->lock);
+        ct->replica_state[node] = failed ? REPLICA_FAILED : REPLICA_READY;
+        if (!failed) srv->cached += ct->replica[node].map_size;
+        pthread_cond_broadcast(&srv->trace_ready);
+    }
+    const bp_trace *trace = ct->replica_state[node] == REPLICA_READY ? &ct->replica[node] : &ct->trace;
+    pthread_mutex_unlock(&srv->lock);
+    return trace;
+}
+
+ /**
+ * Frees the cached traces no running job holds, except those of path keep.
+ * Called with srv->lock held. Returns the number of bytes released.
+ */
+
+static size_t trace_evict_unused(server *srv, const char *keep) {
+    size_t released = 0;
+    cached_trace **link = &srv->traces, *ct;
+    while ((ct = *link) != NULL) {
+        if (ct->refs || ct->loading || (keep && strcmp(ct->path, keep) == 0)) {
+            link = &ct->next;
+            continue;
+        }
+        *link = ct->next;
+        released += cached_bytes(ct);
+        cached_trace_free(ct);
+    }
+    srv->cached -= released;
+    return released;
+}
+
+ /**
+ * Returns the cache entry holding the current contents of j's trace, or NULL
+ * if it is not cached. Called with srv->lock held.
+ */
+
+static cached_trace *trace_cached(const server *srv, const job *j) {
+    for (cached_trace *ct = srv->traces; ct; ct = ct->next) {
+        if (strcmp(ct->path, j->path) == 0 && ct->size == j->size && ct->mtime.tv_sec == j->mtime.tv_sec &&
+            ct->mtime.tv_nsec == j->mtime.tv_nsec && !ct->failed) return ct;
+    }
+    return NULL;
+}
+
+ /**
+ * Returns the bytes job j needs to run on node: its predictor plus, unless
+ * the trace is already cached there, the parsed trace. A binary trace
+ * states its record count; the line count of an unloaded text trace is
+ * unknown, so it is bounded by the shortest possible line ("0 t\n").
+ * Called with srv->lock held.
+ */
+
+static size_t job_cost(const server *srv, const job *j, int node) {
+    if (!j->path || j->size < 0) return j->footprint;
+    const cached_trace *ct = trace_cached(srv, j);
+    if (ct) {
+        int replicate = !ct->loading && node != ct->home && ct->replica_state[node] == REPLICA_NONE;
+        return j->footprint + (replicate ? ct->trace.map_size : 0);
+    }
+    size_t records = j->records ? (size_t)j->records + 1 : (size_t)j->size / 4 + 2;
+    return j->footprint + records * (sizeof(unsigned long int) + 1);
+}
+
+ /**
+ * Removes and returns the oldest queued job that fits in the unreserved part
+ * of the budget, reserving its cost, or NULL if none may start yet. A job
+ * costing more than the whole budget is returned at once, marked too_large.
+ * A job charged nothing for its trace because it is cached holds a reference
+ * to it from here on, so admitting another job cannot evict it first.
+ * Called with srv->lock held.
+ */
+
+static job *job_admit(server *srv, int node) {
+    job *prev = NULL, *j = srv->head;
+    while (j) {
+        size_t cost = job_cost(srv, j, node);
+        if (cost > srv->budget) {
+            j->too_large = 1;
+            cost = 0;
+        } else if (srv->reserved + srv->cached + cost > srv->budget && trace_evict_unused(srv, j->path) > 0) {
+            continue;
+        }
+        if (srv->reserved + srv->cached + cost <= srv->budget || j->too_large) {
+            for (job *skipped = srv->head; skipped != j; skipped = skipped->next) skipped->bypassed++;
+            if (prev) prev->next = j->next;
+            else srv->head = j->next;
+            if (srv->tail == j) srv->tail = prev;
+            j->cost = cost;
+            srv->reserved += cost;
+            if (j->path && j->size >= 0 && (j->pinned = trace_cached(srv, j)) != NULL) j->pinned->refs++;
+            return j;
+        }
+        if (j->bypassed >= SERVER_MAX_BYPASS) return NULL;
+        prev = j;
+        j = j->next;
+    }
+    return NULL;
+}
+
+ /**
+ * Appends the entries of one table, comma separated: int8 perceptron weights,
+ * uint16 TAGE entries, uint64 loop entries and unsigned bytes otherwise.
+ */
+
+static void sb_table(strbuf *out, bp_table_id t, const unsigned char *table, size_t size) {
+    size_t width = t == BP_TABLE_TAGE ? sizeof(uint16_t) : t == BP_TABLE_LOOP ? sizeof(uint64_t) : 1;
+    for (size_t i = 0; i < size / width; i++) {
+        if (t == BP_TABLE_PERCEPTRON) {
+            sb_printf(out, i ? ",%d" : "%d", (signed char)table[i]);
+            continue;
+        }
+        unsigned long value = width == sizeof(uint16_t) ? ((const uint16_t*)table)[i] :
+                              width == sizeof(uint64_t) ? ((const uint64_t*)table)[i] : table[i];
+        sb_printf(out, i ? ",%lu" : "%lu", value);
+    }
+}
+
+ /**
+ * Fills config from the fields of a parsed request line.
+ * Returns NULL, or the error to report if the request cannot run.
+ */
+
+static const char *parse_request(const json_field *fields, int n, bp_config *config) {
+    static const char *geometry_keys[] = { "K", "M1", "N", "M2", "P", "H", "T", "B", "Lmin", "Lmax", "L", "S", "E" };
+    memset(config, 0, sizeof(*config));
+    const json_field *name = n >= 0 ? json_find(fields, n, "predictor") : NULL;
+    if (n < 0) return "malformed request";
+    if (!name || bp_type_from_name(name->value, &config->type) != 0) return "unknown predictor";
+    if (!json_find(fields, n, "trace")) return "missing trace";
+    unsigned long int *geometry[] = { &config->K, &config->M1, &config->N, &config->M2, &config->P, &config->H,
+                                      &config->T, &config->B, &config->Lmin, &config->Lmax, &config->L, &config->S, &config->E };
+    for (int i = 0; i < (int)(sizeof(geometry) / sizeof(geometry[0])); i++) {
+        const json_field *f = json_find(fields, n, geometry_keys[i]);
+        if (f) *geometry[i] = strtoul(f->value, NULL, 10);
+    }
+    const json_field *theta = json_find(fields, n, "theta");
+    if (theta) config->theta = strtol(theta->value, NULL, 10);
+    const json_field *first = json_find(fields, n, "first");
+    const json_field *second = json_find(fields, n, "second");
+    const json_field *policy = json_find(fields, n, "policy");
+    if (policy && bp_policy_from_name(policy->value, &config->policy) != 0) return "unknown policy";
+    if ((first && bp_type_from_name(first->value, &config->first) != 0) ||
+        (second && bp_type_from_name(second->value, &config->second) != 0)) return "unknown component";
+    return NULL;
+}
+
+ /**
+ * Drops the trace buffers from j's reservation once its trace (and the
+ * replica on its node) is loaded, since those bytes now count in
+ * srv->cached; charging them in both would hold back other jobs for the
+ * whole run. Wakes the workers so they can use the released bytes.
+ */
+
+static void job_trace_charged(server *srv, job *j) {
+    pthread_mutex_lock(&srv->lock);
+    if (j->cost > j->footprint) {
+        srv->reserved -= j->cost - j->footprint;
+        j->cost = j->footprint;
+        pthread_cond_broadcast(&srv->job_ready);
+    }
+    pthread_mutex_unlock(&srv->lock);
+}
+
+ /**
+ * Runs an admitted job on a worker of node and appends the JSON response
+ * line to out.
+ */
+
+static void handle_request(server *srv, job *j, strbuf *out, int node) {
+    json_field fields[SERVER_MAX_FIELDS];
+    bp_config config;
+    int n = json_parse_flat(j->request, fields, SERVER_MAX_FIELDS);
+    const char *error = parse_request(fields, n, &config);
+
+    sb_printf(out, "{");
+    const json_field *id = n >= 0 ? json_find(fields, n, "id") : NULL;
+    if (id) {
+        sb_printf(out, "\"id\":");
+        if (id->is_string) sb_json_string(out, id->value);
+        else sb_printf(out, "%s", id->value);
+        sb_printf(out, ",");
+    }
+
+    const json_field *name = error ? NULL : json_find(fields, n, "predictor");
+    const json_field *path = error ? NULL : json_find(fields, n, "trace");
+    if (!error && j->too_large) error = "exceeds memory budget";
+    bp_predictor *bp = NULL;
+    cached_trace *ct = NULL;
+    if (!error && (bp = bp_create(&config)) == NULL) error = "invalid configuration";
+    if (!error && (ct = trace_acquire(srv, path->value, node)) == NULL) error = "unable to read trace";
+    if (error) {
+        sb_printf(out, "\"ok\":false,\"error\":\"%s\"}\n", error);
+        bp_destroy(bp);
+        return;
+    }
+
+    bp_stats stats;
+    const bp_trace *trace = trace_local(srv, ct, node);
+    job_trace_charged(srv, j);
+    bp_batch(bp, trace->addrs, trace->taken, trace->count);
+    trace_release(srv, ct);
+    bp_get_stats(bp, &stats);
+    sb_printf(out, "\"ok\":true,\"predictor\":\"%s\",\"predictions\":%lu,\"mispredictions\":%lu,\"rate\":%.2f",
+              name->value, stats.predictions, stats.mispredictions,
+              stats.predictions ? (double)stats.mispredictions / stats.predictions * 100 : 0.0);
+
+    const json_field *contents = json_find(fields, n, "contents");
+    if (contents && strcmp(contents->value, "true") == 0) {
+        sb_printf(out, ",\"tables\":{");
+        int first = 1;
+        for (int t = 0; t < BP_NUM_TABLES; t++) {
+            size_t size;
+            const unsigned char *table = bp_table(bp, (bp_table_id)t, &size);
+            if (!table) continue;
+            sb_printf(out, "%s\"%s\":[", first ? "" : ",", bp_table_name((bp_table_id)t));
+            sb_table(out, (bp_table_id)t, table, size);
+            sb_printf(out, "]");
+            first = 0;
+        }
+        sb_printf(out, "}");
+    }
+    sb_printf(out, "}\n");
+    bp_destroy(bp);
+}
+
+static void *worker_thread(void *arg) {
+    worker_args *args = (worker_args*)arg;
+    server *srv = args->srv;
+    int node = srv->topo.nodes > 1 ? topology_pin_worker(&srv->topo, args->index) : 0;
+    strbuf out = { NULL, 0, 0 };
+    free(args);
+    for (;;) {
+        job *j;
+        pthread_mutex_lock(&srv->lock);
+        while ((j = job_admit(srv, node)) == NULL) pthread_cond_wait(&srv->job_ready, &srv->lock);
+        pthread_mutex_unlock(&srv->lock);
+
+        out.len = 0;
+        handle_request(srv, j, &out, node);
+        if (j->pinned) trace_release(srv, j->pinned);
+        connection_send(j->conn, out.data, out.len);
+
+        // The freed memory may let several queued jobs start
+        pthread_mutex_lock(&srv->lock);
+        srv->reserved -= j->cost;
+        pthread_cond_broadcast(&srv->job_ready);
+        pthread_mutex_unlock(&srv->lock);
+        connection_release(srv, j->conn);
+        free(j->request);
+        free(j->path);
+        free(j);
+    }
+    return NULL;
+}
+
+ /**
+ * Makes a job for one request line, estimating up front what it needs:
+ * the predictor's footprint and the trace's size, which bounds its buffers,
+ * or the record count of a binary trace, which sizes them.
+ * Returns NULL if memory is exhausted.
+ */
+
+static job *job_create(connection *conn, const char *line) {
+    json_field fields[SERVER_MAX_FIELDS];
+    bp_config config;
+    struct stat st;
+    trace_stats stats;
+    job *j = (job*)calloc(1, sizeof(job));
+    if (!j || (j->request = strdup(line)) == NULL) {
+        free(j);
+        return NULL;
+    }
+    j->conn = conn;
+    int n = json_parse_flat(line, fields, SERVER_MAX_FIELDS);
+    if (parse_request(fields, n, &config) == NULL) {
+        j->footprint = bp_footprint(&config);
+        if ((j->path = strdup(json_find(fields, n, "trace")->value)) == NULL) {
+            free(j->request);
+            free(j);
+            return NULL;
+        }
+        j->size = -1;
+        if (stat(j->path, &st) == 0) {
+            j->size = st.st_size;
+            j->mtime = st.st_mtim;
+            if (trace_read_stats(j->path, &stats) == 0) j->records = stats.records;
+        }
+    }
+    if (j->footprint == 0) j->size = -1;
+    return j;
+}
+
+ /**
+ * Reads request lines from one client and queues each as a job.
+ * The connection stays open until the client hangs up and every queued job
+ * has written its response.
+ */
+
+static void *reader_thread(void *arg) {
+    reader_args *args = (reader_args*)arg;
+    server *srv = args->srv;
+    connection *conn = args->conn;
+    free(args);
+
+    char buf[SERVER_MAX_LINE];
+    size_t len = 0;
+    for (;;) {
+        ssize_t r = read(conn->fd, buf + len, sizeof(buf) - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        len += r;
+        char *start = buf, *nl;
+        while ((nl = memchr(start, '\n', buf + len - start)) != NULL) {
+            *nl = '\0';
+            job *j = nl > start ? job_create(conn, start) : NULL;
+            if (nl > start && !j) {
+                static const char no_memory[] = "{\"ok\":false,\"error\":\"out of memory\"}\n";
+                connection_send(conn, no_memory, sizeof(no_memory) - 1);
+            }
+            if (j) {
+                pthread_mutex_lock(&srv->lock);
+                conn->refs++;
+                if (srv->tail) srv->tail->next = j;
+                else srv->head = j;
+                srv->tail = j;
+                pthread_cond_signal(&srv->job_ready);
+                pthread_mutex_unlock(&srv->lock);
+            }
+            start = nl + 1;
+        }
+        len -= start - buf;
+        memmove(buf, start, len);
+        if (len == sizeof(buf)) {
+            static const char too_long[] = "{\"ok\":false,\"error\":\"request too long\"}\n";
+            connection_send(conn, too_long, sizeof(too_long) - 1);
+            break;
+        }
+    }
+    connection_release(srv, conn);
+    return NULL;
+}
+
+ /**
+ * Listens on socket_path and serves requests until the process is killed.
+ * workers <= 0 selects one worker per online CPU, and budget_mb 0 a memory
+ * budget of three quarters of physical memory.
+ * Returns nonzero if the socket cannot be set up.
+ */
+
+int server_main(const char *socket_path, int workers, unsigned long int budget_mb) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path too long:%s\n", socket_path);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SERVER_BACKLOG) != 0) {
+        printf("Error: Unable to listen on %s\n", socket_path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+    server srv;
+    memset(&srv, 0, sizeof(srv));
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.job_ready, NULL);
+    pthread_cond_init(&srv.trace_ready, NULL);
+    topology_detect(&srv.topo);
+    srv.budget = (size_t)budget_mb << 20;
+    if (budget_mb == 0) srv.budget = (size_t)sysconf(_SC_PHYS_PAGES) / 4 * 3 * (size_t)sysconf(_SC_PAGESIZE);
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        worker_args *args = (worker_args*)malloc(sizeof(worker_args));
+        pthread_t tid;
+        if (!args) continue;
+        args->srv = &srv;
+        args->index = i;
+        if (pthread_create(&tid, NULL, worker_thread, args) != 0) {
+            free(args);
+            continue;
+        }
+        pthread_detach(tid);
+        started++;
+    }
+    if (started == 0) {
+        printf("Error: Unable to start workers\n");
+        close(listen_fd);
+        return 1;
+    }
+    printf("Serving on %s with %d workers", socket_path, started);
+    if (srv.topo.nodes > 1) printf(" on %d NUMA nodes", srv.topo.nodes);
+    printf(" and a %lu MiB memory budget\n", (unsigned long int)(srv.budget >> 20));
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        // A client that cannot be given a reader is hung up on
+        connection *conn = (connection*)malloc(sizeof(connection));
+        reader_args *args = (reader_args*)malloc(sizeof(reader_args));
+        pthread_t tid;
+        if (!conn || !args) {
+            free(conn);
+            free(args);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->write_lock, NULL);
+        args->srv = &srv;
+        args->conn = conn;
+        if (pthread_create(&tid, NULL, reader_thread, args) != 0) {
+            pthread_mutex_destroy(&conn->write_lock);
+            free(conn);
+            free(args);
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(listen_fd);
+    return 1;
+}
@@ -0,0 +1,6 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+int server_main(const char *socket_path, int workers, unsigned long int budget_mb);
+
+#endif
@@ -1,308 +1,1034 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "sim_bp.h"
+#include <sys/time.h>
+#include "bp.h"
+#include "bp_ring.h"
+#include "cache.h"
+#include "compare.h"
+#include "convert.h"
+#include "mlog.h"
+#include "resume.h"
+#include "server.h"
+#include "smt.h"
+#include "trace.h"
+#include "undo.h"
+
+#define TRACE_BATCH 4096
+#define RING_PREFIX "ring:"
+#define RING_CAPACITY (1 << 20)
+#define SPEC_MAX_ARGS 16
+#define PROGRESS_CHUNK (1 << 20)
 
  /**
- * Initializes the branch predictor tables and parameters based on the predictor type.
- * - For bimodal: allocates a 2^M2 table of 2-bit counters initialized to 2 (weakly taken).
- * - For gshare: allocates a 2^M1 table of 2-bit counters initialized to 2, sets global history = 0.
- * - For hybrid: allocates chooser, gshare, and bimodal tables with the same initial values.
+ * Reads the geometry of one tournament component from the next available
+ * arguments: M2 for bimodal, M1 N for gshare, L H S for local.
+ * Returns the number of arguments used, or -1 if there are too few or the
+ * type cannot be a component.
  */
 
-void init_predictor(bp_params *params) {
-    if (strcmp(params->bp_name, "bimodal") == 0) {
-        unsigned long size = 1 << params->M2;
-        params->bimodal_table = (unsigned char*)malloc(size * sizeof(unsigned char));
-        for (unsigned long i = 0; i < size; i++) {
-            params->bimodal_table[i] = 2;
-        }
-    }
-    else if (strcmp(params->bp_name, "gshare") == 0) {
-        unsigned long size = 1 << params->M1;
-        params->gshare_table = (unsigned char*)malloc(size * sizeof(unsigned char));
-        for (unsigned long i = 0; i < size; i++) {
-            params->gshare_table[i] = 2;
-        }
-        params->global_history = 0;
+static int parse_component(bp_type type, char **args, int available, bp_config *config) {
+    int needed = type == BP_BIMODAL ? 1 : type == BP_GSHARE ? 2 : type == BP_LOCAL ? 3 : -1;
+    if (needed < 0 || needed > available) return -1;
+    if (type == BP_BIMODAL) config->M2 = strtoul(args[0], NULL, 10);
+    if (type == BP_GSHARE) {
+        config->M1 = strtoul(args[0], NULL, 10);
+        config->N = strtoul(args[1], NULL, 10);
     }
-    else if (strcmp(params->bp_name, "hybrid") == 0) {
-        unsigned long chooser_size = 1 << params->K;
-        params->chooser_table = (unsigned char*)malloc(chooser_size * sizeof(unsigned char));
-        for (unsigned long i = 0; i < chooser_size; i++) {
-            params->chooser_table[i] = 1;
-        }
-        unsigned long gshare_size = 1 << params->M1;
-        params->gshare_table = (unsigned char*)malloc(gshare_size * sizeof(unsigned char));
-        for (unsigned long i = 0; i < gshare_size; i++) {
-            params->gshare_table[i] = 2;
-        }
-        unsigned long bimodal_size = 1 << params->M2;
-        params->bimodal_table = (unsigned char*)malloc(bimodal_size * sizeof(unsigned char));
-        for (unsigned long i = 0; i < bimodal_size; i++) {
-            params->bimodal_table[i] = 2;
-        }
-        params->global_history = 0;
+    if (type == BP_LOCAL) {
+        config->L = strtoul(args[0], NULL, 10);
+        config->H = strtoul(args[1], NULL, 10);
+        config->S = strtoul(args[2], NULL, 10);
     }
+    return needed;
 }
 
  /**
- * Frees any dynamically allocated memory used by the predictor tables.
+ * Parses the configuration given to --compare, in place: optional
+ * "--loop <E>" and "--policy <P>", then a predictor name and its geometry as
+ * on the command line, without the trace. Fields the spec does not set keep
+ * their value in config. Returns 0, or -1 if the spec is malformed.
  */
 
-void free_predictor(bp_params *params) {
-    if (params->bimodal_table) free(params->bimodal_table);
-    if (params->gshare_table) free(params->gshare_table);
-    if (params->chooser_table) free(params->chooser_table);
+static int parse_spec(char *spec, bp_config *config) {
+    char *args[SPEC_MAX_ARGS];
+    int n = 0, used = 1;
+    for (char *arg = strtok(spec, " "); arg; arg = strtok(NULL, " ")) {
+        if (n == SPEC_MAX_ARGS) return -1;
+        args[n++] = arg;
+    }
+    char **a = args;
+    while (n >= 2 && strncmp(a[0], "--", 2) == 0) {
+        if (strcmp(a[0], "--loop") == 0) config->E = strtoul(a[1], NULL, 10);
+        else if (strcmp(a[0], "--policy") != 0 || bp_policy_from_name(a[1], &config->policy) != 0) return -1;
+        a += 2;
+        n -= 2;
+    }
+    if (n < 1 || bp_type_from_name(a[0], &config->type) != 0) return -1;
+    switch (config->type) {
+    case BP_BIMODAL:
+    case BP_GSHARE:
+    case BP_LOCAL:
+        if ((used = parse_component(config->type, a + 1, n - 1, config)) < 0) return -1;
+        used++;
+        break;
+    case BP_PERCEPTRON:
+        if (n != 4) return -1;
+        config->P = strtoul(a[1], NULL, 10);
+        config->H = strtoul(a[2], NULL, 10);
+        config->theta = strtol(a[3], NULL, 10);
+        return 0;
+    case BP_LOOP:
+        if (n != 2) return -1;
+        config->E = strtoul(a[1], NULL, 10);
+        return 0;
+    case BP_TAGE:
+        if (n != 6) return -1;
+        config->M2 = strtoul(a[1], NULL, 10);
+        config->T = strtoul(a[2], NULL, 10);
+        config->B = strtoul(a[3], NULL, 10);
+        config->Lmin = strtoul(a[4], NULL, 10);
+        config->Lmax = strtoul(a[5], NULL, 10);
+        return 0;
+    case BP_TOURNAMENT:
+        if (n < 4 || bp_type_from_name(a[2], &config->first) != 0 || bp_type_from_name(a[3], &config->second) != 0) return -1;
+        config->K = strtoul(a[1], NULL, 10);
+        used = 4;
+        int k = parse_component(config->first, a + used, n - used, config);
+        if (k < 0) return -1;
+        used += k;
+        if ((k = parse_component(config->second, a + used, n - used, config)) < 0) return -1;
+        used += k;
+        break;
+    default:
+        if (n != 5) return -1;
+        config->K = strtoul(a[1], NULL, 10);
+        config->M1 = strtoul(a[2], NULL, 10);
+        config->N = strtoul(a[3], NULL, 10);
+        config->M2 = strtoul(a[4], NULL, 10);
+        return 0;
+    }
+    return used == n ? 0 : -1;
 }
 
  /**
- * Prints the final contents of each prediction table to stdout.
- * Output format matches branch prediction project specification.
+ * Per-branch outputs of a run (see mlog.h and undo.c); NULL when not
+ * requested. In compare mode other is the second configuration, simulated
+ * in lockstep, and comparison accumulates where the two agree (see
+ * compare.c).
+ */
+
+typedef struct branch_logs{
+    mlog         *mispredictions;
+    mlog         *annotated;
+    bp_predictor *other;
+    compare      *comparison;
+    mlog         *disagreements;
+    undo_log     *undo;
+}branch_logs;
+
+ /**
+ * Simulates a chunk branch by branch through bp_predict/bp_update, writing
+ * one record per branch describing the prediction to the annotated trace,
+ * recording what each branch changed in the undo log, and setting the bits
+ * of the mispredicted branches as bp_batch_log does.
  */
 
-void print_final_contents(bp_params *params) {
-    if (strcmp(params->bp_name, "bimodal") == 0) {
-        printf("FINAL BIMODAL CONTENTS\n");
-        unsigned long size = 1 << params->M2;
-        for (unsigned long i = 0; i < size; i++) {
-            printf("%lu      %u\n", i, params->bimodal_table[i]);
+static void annotate_chunk(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count,
+                           const branch_logs *logs, mlog_record *records, uint64_t *mispredicted) {
+    const bp_config *config = bp_get_config(bp);
+    int loop = config->E && config->type != BP_PERCEPTRON && config->type != BP_TAGE;
+    memset(mispredicted, 0, (count + 63) / 64 * sizeof(uint64_t));
+    for (size_t i = 0; i < count; i++) {
+        bp_prediction pred;
+        bp_predict(bp, addrs[i], &pred);
+        int correct = bp_update(bp, &pred, taken[i]);
+        mispredicted[i / 64] |= (uint64_t)!correct << (i % 64);
+        if (logs->undo && undo_branch(logs->undo, bp, &pred) != 0) {
+            printf("Error: Out of memory recording the undo log\n");
+            exit(EXIT_FAILURE);
         }
+        if (!logs->annotated) continue;
+        mlog_record *r = &records[i];
+        memset(r, 0, sizeof(*r));
+        r->addr = addrs[i];
+        r->taken = taken[i] != 0;
+        r->predicted = (uint8_t)pred.taken;
+        r->provider = (uint8_t)pred.provider;
+        r->tage_provider = (int8_t)(config->type == BP_TAGE ? pred.tage_provider : -1);
+        r->flags = (pred.confidence ? MLOG_CONFIDENT : 0) | (loop && pred.taken != pred.base_taken ? MLOG_LOOP_OVERRIDE : 0);
     }
-    else if (strcmp(params->bp_name, "gshare") == 0) {
-        printf("FINAL GSHARE CONTENTS\n");
-        unsigned long size = 1 << params->M1;
-        for (unsigned long i = 0; i < size; i++) {
-            printf("%lu      %u\n", i, params->gshare_table[i]);
+    if (logs->annotated) mlog_write(logs->annotated, records, count * sizeof(mlog_record));
+}
+
+ /**
+ * Simulates a chunk of at most TRACE_BATCH branches on bp, appending every
+ * outcome to the misprediction log and, for an annotated trace or an undo
+ * log, one record per branch (which needs the branch-by-branch path instead
+ * of bp_batch).
+ * In compare mode the other configuration then runs the same chunk and the
+ * two outcomes of every branch are accounted.
+ */
+
+static void log_chunk(bp_predictor *bp, const unsigned long int *addrs, const unsigned char *taken, size_t count,
+                      const branch_logs *logs) {
+    static mlog_record records[TRACE_BATCH];
+    uint64_t mispredicted[TRACE_BATCH / 64];
+    if (!logs->annotated && !logs->undo) bp_batch_log(bp, addrs, taken, count, mispredicted);
+    else annotate_chunk(bp, addrs, taken, count, logs, records, mispredicted);
+    if (logs->mispredictions) mlog_bits(logs->mispredictions, mispredicted, count);
+    if (logs->other) {
+        // The second configuration sees the same chunk while it is still in cache
+        uint64_t other_mispredicted[TRACE_BATCH / 64];
+        bp_batch_log(logs->other, addrs, taken, count, other_mispredicted);
+        if (compare_chunk(logs->comparison, addrs, mispredicted, other_mispredicted, count, logs->disagreements) != 0) {
+            printf("Error: Out of memory comparing configurations\n");
+            exit(EXIT_FAILURE);
         }
     }
-    else if (strcmp(params->bp_name, "hybrid") == 0) {
-        printf("FINAL CHOOSER CONTENTS\n");
-        unsigned long chooser_size = 1 << params->K;
-        for (unsigned long i = 0; i < chooser_size; i++) {
-            printf("%lu      %u\n", i, params->chooser_table[i]);
-        }
-        printf("FINAL GSHARE CONTENTS\n");
-        unsigned long gshare_size = 1 << params->M1;
-        for (unsigned long i = 0; i < gshare_size; i++) {
-            printf("%lu      %u\n", i, params->gshare_table[i]);
-        }
-        printf("FINAL BIMODAL CONTENTS\n");
-        unsigned long bimodal_size = 1 << params->M2;
-        for (unsigned long i = 0; i < bimodal_size; i++) {
-            printf("%lu      %u\n", i, params->bimodal_table[i]);
+}
+
+ /**
+ * Feeds one chunk of the trace to every predictor in turn, so a sweep reads
+ * the trace once while each chunk is still in cache. With per-branch logs
+ * or a comparison there is a single predictor.
+ */
+
+static void batch_all(bp_predictor **bps, int nbps, const unsigned long int *addrs, const unsigned char *taken, size_t count,
+                      const branch_logs *logs) {
+    if (logs->mispredictions || logs->annotated || logs->other || logs->undo) {
+        for (size_t done = 0; done < count; done += TRACE_BATCH) {
+            size_t n = count - done < TRACE_BATCH ? count - done : TRACE_BATCH;
+            log_chunk(bps[0], addrs + done, taken + done, n, logs);
         }
+        return;
     }
+    for (int i = 0; i < nbps; i++) bp_batch(bps[i], addrs, taken, count);
 }
 
  /**
- * Simulates one branch for a Bimodal predictor.
- * - Index derived from lower M2 bits of PC.
- * - Updates 2-bit counter based on outcome (t/n).
- * Returns 1 if prediction was correct, 0 if mispredicted.
+ * Gives every predictor a kernel compiled for its exact configuration (see
+ * bp_jit.c), cached in dir. Predictors it cannot cover keep the generic
+ * kernels, with a note on stderr.
  */
 
-int bimodal_predict(bp_params *params, unsigned long int addr, char outcome) {
-    unsigned long index = (addr >> 2) & ((1 << params->M2) - 1);
-    unsigned char prediction = params->bimodal_table[index];
-    int pred_taken = prediction >= 2;
+static void jit_all(bp_predictor **bps, int nbps, const char *dir) {
+    int generic = 0;
+    for (int i = 0; i < nbps; i++) generic |= bp_jit(bps[i], dir) != 0;
+    if (generic) fprintf(stderr, "Note: No specialized kernel available, using the generic one\n");
+}
 
-     // Update counter based on actual outcome
-    if (outcome == 't') {
-        if (prediction < 3) params->bimodal_table[index]++;
+static void destroy_all(bp_predictor **bps, int nbps) {
+    for (int i = 0; i < nbps; i++) bp_destroy(bps[i]);
+}
+
+ /**
+ * Progress through a trace whose record count is known up front (see
+ * trace_scan), reported on stderr at most every interval seconds.
+ */
+
+typedef struct progress{
+    uint64_t          total;
+    uint64_t          done;
+    double            interval;
+    struct timeval    start;
+    struct timeval    last;
+}progress;
+
+static double seconds_between(const struct timeval *from, const struct timeval *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1e6;
+}
+
+ /**
+ * Accounts count more simulated branches, and with finished prints the
+ * final line.
+ */
+
+static void progress_update(progress *p, size_t count, int finished) {
+    struct timeval now;
+    p->done += count;
+    gettimeofday(&now, NULL);
+    if (!finished && seconds_between(&p->last, &now) < p->interval) return;
+    p->last = now;
+    double fraction = p->total ? (double)p->done / p->total : 1.0;
+    double elapsed = seconds_between(&p->start, &now);
+    if (fraction > 1.0) fraction = 1.0;
+    fprintf(stderr, "\rProgress: %.1f%% (%llu of %llu branches, %.0f s elapsed, %.0f s left)%s", fraction * 100,
+            (unsigned long long)p->done, (unsigned long long)p->total, elapsed,
+            fraction > 0 ? elapsed / fraction - elapsed : 0.0, finished ? "\n" : "");
+}
+
+ /**
+ * Feeds a loaded trace to batch_all, in pieces when reporting progress.
+ */
+
+static void simulate(bp_predictor **bps, int nbps, const bp_trace *trace, const branch_logs *logs, progress *p) {
+    if (!p) {
+        batch_all(bps, nbps, trace->addrs, trace->taken, trace->count, logs);
+        return;
     }
-    else {
-        if (prediction > 0) params->bimodal_table[index]--;
+    for (size_t done = 0; done < trace->count; done += PROGRESS_CHUNK) {
+        size_t n = trace->count - done < PROGRESS_CHUNK ? trace->count - done : PROGRESS_CHUNK;
+        batch_all(bps, nbps, trace->addrs + done, trace->taken + done, n, logs);
+        progress_update(p, n, 0);
     }
-    return pred_taken == (outcome == 't');
+}
+
+static void print_rates(FILE *out, const bp_stats *stats) {
+    fprintf(out, "Number of predictions: %lu\n", stats->predictions);
+    fprintf(out, "Number of mispredictions: %lu\n", stats->mispredictions);
+    fprintf(out, "Misprediction rate: %.2f%%\n", (double)stats->mispredictions / stats->predictions * 100);
 }
 
  /**
- * Simulates one branch for a Gshare predictor.
- * - Combines N bits of global history with M1 bits of PC via XOR.
- * - Updates predictor table and global history after each branch.
- * Returns 1 if prediction was correct, 0 otherwise.
+ * Splits a comma-separated SMT trace list in place and reads the matching
+ * weights ("1" each when list is NULL). Returns the number of threads, or -1
+ * if there are too many traces or the weights do not match them.
  */
 
-int gshare_predict(bp_params *params, unsigned long int addr, char outcome) {
-    unsigned long pc_upper_n = (addr >> (params->M1 - params->N + 2)) & ((1 << params->N) - 1);
-    unsigned long xor_result = pc_upper_n ^ (params->global_history & ((1 << params->N) - 1));
-    unsigned long mlessn_bits = (addr >> 2) & ((1 << (params->M1 - params->N)) - 1);
-    unsigned long index = (xor_result << (params->M1 - params->N)) | mlessn_bits;
-    unsigned char prediction = params->gshare_table[index];
-    int pred_taken = prediction >= 2;
+static int parse_smt(char *traces, const char *list, char **paths, unsigned int *weights) {
+    int threads = 0;
+    for (char *path = strtok(traces, ","); path; path = strtok(NULL, ",")) {
+        if (threads == SMT_MAX_THREADS) return -1;
+        weights[threads] = 1;
+        paths[threads++] = path;
+    }
+    if (list == NULL) return threads;
+    for (int i = 0; i < threads; i++) {
+        char *end;
+        unsigned long int weight = strtoul(list, &end, 10);
+        if (end == list || weight == 0 || weight > 1000000 || *end != (i == threads - 1 ? '\0' : ',')) return -1;
+        weights[i] = (unsigned int)weight;
+        list = end + 1;
+    }
+    return threads;
+}
+
+ /**
+ * Parses a --flush list: "none", "history", "tables", "all", or table names
+ * (as in bp_table_name) optionally with "history", separated by commas.
+ * Returns the bp_flush mask, or -1 if a name is unknown.
+ */
 
-    // Update table counter
-    if (outcome == 't') {
-        if (prediction < 3) params->gshare_table[index]++;
-    } else {
-        if (prediction > 0) params->gshare_table[index]--;
+static long parse_flush(const char *spec) {
+    char buf[128];
+    long mask = 0;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *name = strtok(buf, ","); name; name = strtok(NULL, ",")) {
+        int found = 1;
+        if (strcmp(name, "history") == 0) mask |= BP_FLUSH_HISTORY;
+        else if (strcmp(name, "tables") == 0) mask |= BP_FLUSH_TABLES;
+        else if (strcmp(name, "all") == 0) mask |= BP_FLUSH_TABLES | BP_FLUSH_HISTORY;
+        else if (strcmp(name, "none") != 0) {
+            found = 0;
+            for (int t = 0; t < BP_NUM_TABLES; t++) {
+                if (strcmp(name, bp_table_name((bp_table_id)t)) == 0) {
+                    mask |= 1L << t;
+                    found = 1;
+                }
+            }
+        }
+        if (!found) return -1;
     }
+    return mask;
+}
 
-    // Update global history register
-    if (outcome == 't') {
-        params->global_history = ((1 << (params->N - 1)) | (params->global_history >> 1)) & ((1 << params->N) - 1);
-    } else {
-        params->global_history = (params->global_history >> 1) & ((1 << params->N) - 1);
+ /**
+ * Inspects an undo log written by --undo-log (see undo.c):
+ * "--undo-state <log> <branch>" prints every table as it was after that many
+ * branches, "--undo-history <log> <table> <entry>" each value one entry took
+ * and after which branch.
+ */
+
+static int undo_main(int argc, char *argv[]) {
+    int state = strcmp(argv[1], "--undo-state") == 0;
+    if (argc != (state ? 4 : 5)) {
+        printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+        exit(EXIT_FAILURE);
+    }
+    undo_reader *reader = undo_open(argv[2]);
+    if (reader == NULL) {
+        printf("Error: Unable to read undo log %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long long branches = (unsigned long long)undo_branches(reader);
+    if (state) {
+        char *end;
+        unsigned long long branch = strtoull(argv[3], &end, 10);
+        bp_predictor *bp = *end == '\0' ? undo_state(reader, branch) : NULL;
+        if (bp == NULL) {
+            printf("Error: Unable to rebuild branch %s of %llu\n", argv[3], branches);
+            undo_free(reader);
+            exit(EXIT_FAILURE);
+        }
+        printf("STATE %llu OF %llu\n", branch, branches);
+        bp_print_contents(bp, stdout);
+        bp_destroy(bp);
     }
-    return pred_taken == (outcome == 't');
+    else {
+        int table = -1;
+        for (int t = 0; t < BP_NUM_TABLES; t++) {
+            if (strcmp(argv[3], bp_table_name((bp_table_id)t)) == 0) table = t;
+        }
+        printf("HISTORY %s %s OF %llu\n", argv[3], argv[4], branches);
+        if (table < 0 || undo_history(reader, (bp_table_id)table, strtoul(argv[4], NULL, 10), stdout) != 0) {
+            printf("Error: No entry %s in table %s\n", argv[4], argv[3]);
+            undo_free(reader);
+            exit(EXIT_FAILURE);
+        }
+    }
+    undo_free(reader);
+    return 0;
 }
 
  /**
- * Simulates one branch for a Hybrid predictor (chooser + gshare + bimodal).
- * - Chooser decides which predictor to trust based on its 2-bit counter.
- * - Both gshare and bimodal tables are updated independently based on the chooser result.
- * - Chooser table is updated depending on which predictor was correct.
- * Returns 1 if the final prediction matched the actual outcome, 0 otherwise.
+ * Statistics mode: "sim --stats <trace>..." prints what the header of each
+ * binary trace states, or what a parallel scan finds in a text trace (see
+ * trace_scan): the same numbers either way.
  */
 
-int hybrid_predict(bp_params *params, unsigned long int addr, char outcome) {
-    // Computes gshare, bimodal, and chooser index
-    unsigned long pc_upper_n = (addr >> (params->M1 - params->N + 2)) & ((1 << params->N) - 1);
-    unsigned long xor_result = pc_upper_n ^ (params->global_history & ((1 << params->N) - 1));
-    unsigned long mlessn_bits = (addr >> 2) & ((1 << (params->M1 - params->N)) - 1);
-    unsigned long gshare_index = (xor_result << (params->M1 - params->N)) | mlessn_bits;
-    unsigned char gshare_prediction = params->gshare_table[gshare_index];
-    int gshare_taken = gshare_prediction >= 2;
-    unsigned long bimodal_index = (addr >> 2) & ((1 << params->M2) - 1);
-    unsigned char bimodal_prediction = params->bimodal_table[bimodal_index];
-    int bimodal_taken = bimodal_prediction >= 2;
-    unsigned long chooser_index = (addr >> 2) & ((1 << params->K) - 1);
-    unsigned char chooser = params->chooser_table[chooser_index];
-    int final_prediction;
-
-    // Update the predictor chosen by the chooser
-    if (chooser >= 2) {
-        final_prediction = gshare_taken;
-    } else {
-        final_prediction = bimodal_taken;
-    }
-    if (chooser >= 2) {
-        if (outcome == 't') {
-            if (gshare_prediction < 3) params->gshare_table[gshare_index]++;
-        } else {
-            if (gshare_prediction > 0) params->gshare_table[gshare_index]--;
-        }
-    } else {
-        if (outcome == 't') {
-            if (bimodal_prediction < 3) params->bimodal_table[bimodal_index]++;
-        } else {
-            if (bimodal_prediction > 0) params->bimodal_table[bimodal_index]--;
-        }
-    }
-
-    // Update global history
-    if (outcome == 't') {
-        params->global_history = ((1 << (params->N - 1)) | (params->global_history >> 1)) & ((1 << params->N) - 1);
-    } else {
-        params->global_history = (params->global_history >> 1) & ((1 << params->N) - 1);
-    }
-    // Determine correctness and update chooser
-    int gshare_correct = (gshare_taken == (outcome == 't'));
-    int bimodal_correct = (bimodal_taken == (outcome == 't'));
-
-    if (gshare_correct && !bimodal_correct) {
-        if (chooser < 3) params->chooser_table[chooser_index]++;
-    } else if (bimodal_correct && !gshare_correct) {
-        if (chooser > 0) params->chooser_table[chooser_index]--;
-    }
-    return final_prediction == (outcome == 't');
+static int stats_main(int argc, char *argv[]) {
+    int failed = 0;
+    for (int i = 2; i < argc; i++) {
+        trace_stats stats;
+        if (trace_scan(argv[i], &stats) != 0) {
+            printf("Error: Unable to scan %s\n", argv[i]);
+            failed = 1;
+            continue;
+        }
+        printf("STATS %s %llu records %llu unique PCs %.2f%% taken hash %016llx\n", argv[i],
+               (unsigned long long)stats.records, (unsigned long long)stats.unique_pcs,
+               stats.records ? (double)stats.taken / stats.records * 100 : 0.0, (unsigned long long)stats.hash);
+    }
+    return failed;
 }
 
  /**
  * Main entry point.
  * Parses command-line arguments, sets up predictor type and parameters,
  * reads a branch trace file, runs predictions, and reports accuracy statistics.
+ * "sim --server <socket> [workers [memory MiB]]" runs the daemon mode instead (see server.c).
+ * "sim --undo-state" and "sim --undo-history" query an undo log (see undo_main).
+ * "sim --convert <output dir> <trace>..." writes binary traces (see convert.c).
+ * "sim --stats <trace>..." prints trace statistics (see stats_main).
+ * A trace argument of the form "ring:<name>" reads records from a live
+ * producer through the shared-memory ring in bp_ring.h. Binary traces (see
+ * trace.h) are recognised by their header.
+ * Options before the predictor name:
+ * - "--loop <E>" adds a 2^E-entry loop predictor that overrides it on
+ *   confidently predicted loop branches.
+ * - "--policy <chosen|both|disagree>" sets the hybrid/tournament update
+ *   policy; "--policy all" evaluates every policy in the same pass over the
+ *   trace, printing one POLICY section per policy.
+ * - "--isa <auto|scalar|sse4.2|avx2|avx512>" forces one build of the vector
+ *   kernels (perceptron, TAGE and trace parsing) instead of the best the CPU
+ *   supports, e.g. to check a variant against the scalar reference.
+ * A trace argument listing several files separated by commas runs them as
+ * SMT threads interleaved into one predictor (see smt.c), printing a THREAD
+ * section per trace after the combined rates. Its options:
+ * - "--weights <w1,w2,...>" takes w_i consecutive branches from thread i per
+ *   round (default 1 each, plain round robin).
+ * - "--history <shared|private>" gives each thread its own global history
+ *   instead of one shared by all (the default).
+ * - "--quantum <Q>" runs the traces in time slices of Q branches instead,
+ *   as a multiprogrammed core, and adds a SLICES section.
+ * - "--flush <what>" resets state on every context switch (see parse_flush).
+ * "--cache <dir>" keeps the output of single-trace runs in a result cache
+ * (see cache.c) keyed by trace content, configuration and simulator binary,
+ * and prints a stored result instead of simulating on a hit;
+ * "--cache-limit <MiB>" bounds the directory (default 1024).
+ * "--resume <state>" continues from the predictors saved in the state file
+ * by the previous run over the same trace (see resume.c), simulating only
+ * the records appended since, and then saves the state again. A state that
+ * does not match is discarded with a warning and the run starts over.
+ * "--mispredict-log <file>" writes which dynamic branches mispredicted, one
+ * run-length encoded bit each, and "--annotate <file>" a binary record per
+ * branch with its prediction and provider (formats in mlog.h).
+ * "--jit <dir>" runs bimodal, gshare and hybrid through a kernel generated
+ * and compiled for the exact configuration (see bp_jit.c), cached in dir.
+ * "--undo-log <file>" records every change to the tables, with a full
+ * snapshot every "--undo-interval <branches>" (default 65536), so
+ * "sim --undo-state" and "sim --undo-history" (see undo_main) can show the
+ * state at any branch.
+ * "--compare <spec>" runs a second configuration B (see parse_spec) in
+ * lockstep over the same pass, printing its rates in a COMPARE section and
+ * how often each PC was predicted correctly by both, only one or neither;
+ * "--disagreements <file>" streams the branches only one got right.
+ * "--progress <seconds>" reports on stderr, that often, how much of the
+ * trace has been simulated, out of the record count stated by a binary
+ * trace or found by scanning a text one first.
  */
 
 int main (int argc, char* argv[]) {
     FILE *FP;               
     char *trace_file;      
-    bp_params params;      
-    char outcome;           
+    char *bp_name;
+    bp_config config;
+    bp_predictor *bps[BP_NUM_POLICIES];
+    int nbps = 1;
+    bp_stats stats;
+    unsigned long int addrs[TRACE_BATCH];
+    unsigned char outcomes[TRACE_BATCH];
     unsigned long int addr; 
-    unsigned int predictions = 0, mispredictions = 0;
+    unsigned long int loop_bits = 0;
+    bp_update_policy policy = BP_UPDATE_CHOSEN;
+    bp_isa isa = BP_ISA_AUTO;
+    int private_history = 0;
+    const char *weight_list = NULL;
+    char *smt_paths[SMT_MAX_THREADS];
+    unsigned int smt_weights[SMT_MAX_THREADS];
+    bp_stats smt_stats[SMT_MAX_THREADS];
+    int smt_threads = 0;
+    unsigned long int quantum = 0;
+    long flush = 0;
+    smt_slice *slices = NULL;
+    size_t nslices = 0;
+    const char *cache_dir = NULL;
+    const char *resume_path = NULL;
+    const char *jit_dir = NULL;
+    const char *log_path = NULL;
+    const char *annotate_path = NULL;
+    const char *undo_path = NULL;
+    unsigned long int undo_interval = UNDO_DEFAULT_INTERVAL;
+    const char *compare_spec = NULL;
+    const char *disagreements_path = NULL;
+    branch_logs logs = { NULL, NULL, NULL, NULL, NULL, NULL };
+    double progress_interval = -1;
+    progress run_progress;
+    progress *report = NULL;
+    trace_stats trace_info;
+    int trace_known = 0;
+    uint64_t config_key = 0;
+    unsigned long int cache_limit = CACHE_DEFAULT_LIMIT_MB;
+    uint64_t cache_key = 0;
+    char *cache_text = NULL;
+    size_t cache_len = 0;
+    FILE *out = stdout;
+    char command[128];
+
+    // Daemon mode serves requests over a Unix domain socket
+    if (argc >= 3 && strcmp(argv[1], "--server") == 0) {
+        if (argc > 5) {
+            printf("Error: --server wrong number of inputs:%d\n", argc-1);
+            exit(EXIT_FAILURE);
+        }
+        return server_main(argv[2], argc >= 4 ? atoi(argv[3]) : 0, argc == 5 ? strtoul(argv[4], NULL, 10) : 0);
+    }
+
+    // Conversion to binary traces runs on its own worker pool
+    if (argc >= 2 && strcmp(argv[1], "--convert") == 0) {
+        if (argc < 4) {
+            printf("Error: --convert wrong number of inputs:%d\n", argc-1);
+            exit(EXIT_FAILURE);
+        }
+        return convert_main(argv[2], argv + 3, argc - 3);
+    }
+
+    // Statistics come from trace headers or a scan
+    if (argc >= 2 && strcmp(argv[1], "--stats") == 0) {
+        if (argc < 3) {
+            printf("Error: --stats wrong number of inputs:%d\n", argc-1);
+            exit(EXIT_FAILURE);
+        }
+        return stats_main(argc, argv);
+    }
+
+    // Undo logs are inspected without simulating
+    if (argc >= 2 && (strcmp(argv[1], "--undo-state") == 0 || strcmp(argv[1], "--undo-history") == 0)) {
+        return undo_main(argc, argv);
+    }
+
+    // Options come before the predictor name; COMMAND still echoes them
+    size_t command_len = (size_t)snprintf(command, sizeof(command), "%s", argv[0]);
+    while (argc >= 3 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--loop") == 0) {
+            loop_bits = strtoul(argv[2], NULL, 10);
+        }
+        else if (strcmp(argv[1], "--policy") == 0) {
+            if (strcmp(argv[2], "all") == 0) nbps = BP_NUM_POLICIES;
+            else if (bp_policy_from_name(argv[2], &policy) != 0) {
+                printf("Error: Wrong update policy:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--isa") == 0) {
+            if (bp_isa_from_name(argv[2], &isa) != 0) {
+                printf("Error: Wrong instruction set:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+            if (trace_set_isa(isa) != 0) {
+                printf("Error: Instruction set not supported by this CPU:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--history") == 0) {
+            if (strcmp(argv[2], "private") == 0) private_history = 1;
+            else if (strcmp(argv[2], "shared") != 0) {
+                printf("Error: Wrong history mode:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--weights") == 0) {
+            weight_list = argv[2];
+        }
+        else if (strcmp(argv[1], "--quantum") == 0) {
+            quantum = strtoul(argv[2], NULL, 10);
+            if (quantum == 0 || quantum > 1000000000UL) {
+                printf("Error: Wrong quantum:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--cache") == 0) {
+            cache_dir = argv[2];
+        }
+        else if (strcmp(argv[1], "--resume") == 0) {
+            resume_path = argv[2];
+        }
+        else if (strcmp(argv[1], "--jit") == 0) {
+            jit_dir = argv[2];
+        }
+        else if (strcmp(argv[1], "--mispredict-log") == 0) {
+            log_path = argv[2];
+        }
+        else if (strcmp(argv[1], "--annotate") == 0) {
+            annotate_path = argv[2];
+        }
+        else if (strcmp(argv[1], "--undo-log") == 0) {
+            undo_path = argv[2];
+        }
+        else if (strcmp(argv[1], "--undo-interval") == 0) {
+            undo_interval = strtoul(argv[2], NULL, 10);
+        }
+        else if (strcmp(argv[1], "--compare") == 0) {
+            compare_spec = argv[2];
+        }
+        else if (strcmp(argv[1], "--disagreements") == 0) {
+            disagreements_path = argv[2];
+        }
+        else if (strcmp(argv[1], "--progress") == 0) {
+            char *end;
+            progress_interval = strtod(argv[2], &end);
+            if (*end != '\0' || progress_interval < 0) {
+                printf("Error: Wrong progress interval:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--cache-limit") == 0) {
+            cache_limit = strtoul(argv[2], NULL, 10);
+        }
+        else if (strcmp(argv[1], "--flush") == 0) {
+            if ((flush = parse_flush(argv[2])) < 0) {
+                printf("Error: Wrong flush list:%s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            printf("Error: Unknown option:%s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        if (command_len < sizeof(command)) {
+            command_len += (size_t)snprintf(command + command_len, sizeof(command) - command_len, " %s %s", argv[1], argv[2]);
+        }
+        argv += 2;
+        argc -= 2;
+        argv[0] = command;
+    }
 
     // Validate number of arguments
-    if (!(argc == 4 || argc == 5 || argc == 7)) {
+    if (argc < 4 || argc > 12) {
         printf("Error: Wrong number of inputs:%d\n", argc-1);
         exit(EXIT_FAILURE);
     }
 
     // Determine predictor type from command line
-    params.bp_name  = argv[1];
+    bp_name = argv[1];
+    memset(&config, 0, sizeof(config));
+    if (bp_type_from_name(bp_name, &config.type) != 0) {
+        printf("Error: Wrong branch predictor name:%s\n", bp_name);
+        exit(EXIT_FAILURE);
+    }
+    config.E = loop_bits;
+    config.isa = isa;
 
     // Handle predictor-specific parameter parsing
-    if(strcmp(params.bp_name, "bimodal") == 0) {
+    if(config.type == BP_BIMODAL) {
         if(argc != 4) {
-            printf("Error: %s wrong number of inputs:%d\n", params.bp_name, argc-1);
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
             exit(EXIT_FAILURE);
         }
-        params.M2 = strtoul(argv[2], NULL, 10);
+        config.M2 = strtoul(argv[2], NULL, 10);
         trace_file = argv[3];
-        printf("COMMAND\n%s %s %lu %s\n", argv[0], params.bp_name, params.M2, trace_file);
-        init_predictor(&params);
+        printf("COMMAND\n%s %s %lu %s\n", argv[0], bp_name, config.M2, trace_file);
     }
-    else if(strcmp(params.bp_name, "gshare") == 0) {
+    else if(config.type == BP_GSHARE) {
         if(argc != 5) {
-            printf("Error: %s wrong number of inputs:%d\n", params.bp_name, argc-1);
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
             exit(EXIT_FAILURE);
         }
-        params.M1 = strtoul(argv[2], NULL, 10);
-        params.N = strtoul(argv[3], NULL, 10);
+        config.M1 = strtoul(argv[2], NULL, 10);
+        config.N = strtoul(argv[3], NULL, 10);
         trace_file = argv[4];
-        printf("COMMAND\n%s %s %lu %lu %s\n", argv[0], params.bp_name, params.M1, params.N, trace_file);
-        init_predictor(&params);
+        printf("COMMAND\n%s %s %lu %lu %s\n", argv[0], bp_name, config.M1, config.N, trace_file);
+    }
+    else if(config.type == BP_PERCEPTRON) {
+        if(argc != 6) {
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        config.P = strtoul(argv[2], NULL, 10);
+        config.H = strtoul(argv[3], NULL, 10);
+        config.theta = strtol(argv[4], NULL, 10);
+        trace_file = argv[5];
+        printf("COMMAND\n%s %s %lu %lu %ld %s\n", argv[0], bp_name, config.P, config.H, config.theta, trace_file);
     }
-    else if(strcmp(params.bp_name, "hybrid") == 0) {
+    else if(config.type == BP_LOOP) {
+        if(argc != 4) {
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        config.E = strtoul(argv[2], NULL, 10);
+        trace_file = argv[3];
+        printf("COMMAND\n%s %s %lu %s\n", argv[0], bp_name, config.E, trace_file);
+    }
+    else if(config.type == BP_LOCAL) {
+        if(argc != 6) {
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        config.L = strtoul(argv[2], NULL, 10);
+        config.H = strtoul(argv[3], NULL, 10);
+        config.S = strtoul(argv[4], NULL, 10);
+        trace_file = argv[5];
+        printf("COMMAND\n%s %s %lu %lu %lu %s\n", argv[0], bp_name, config.L, config.H, config.S, trace_file);
+    }
+    else if(config.type == BP_TOURNAMENT) {
+        // tournament <K> <first> <second> <first geometry> <second geometry> <tracefile>
+        int used = 5, n = -1;
+        if(argc >= 7 && bp_type_from_name(argv[3], &config.first) == 0 && bp_type_from_name(argv[4], &config.second) == 0 &&
+           (n = parse_component(config.first, argv + used, argc - 1 - used, &config)) >= 0) {
+            used += n;
+            if ((n = parse_component(config.second, argv + used, argc - 1 - used, &config)) >= 0) used += n;
+        }
+        if(n < 0 || used != argc - 1) {
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        config.K = strtoul(argv[2], NULL, 10);
+        trace_file = argv[used];
+        printf("COMMAND\n%s", argv[0]);
+        for (int i = 1; i < argc; i++) printf(" %s", argv[i]);
+        printf("\n");
+    }
+    else if(config.type == BP_TAGE) {
+        if(argc != 8) {
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
+            exit(EXIT_FAILURE);
+        }
+        config.M2 = strtoul(argv[2], NULL, 10);
+        config.T = strtoul(argv[3], NULL, 10);
+        config.B = strtoul(argv[4], NULL, 10);
+        config.Lmin = strtoul(argv[5], NULL, 10);
+        config.Lmax = strtoul(argv[6], NULL, 10);
+        trace_file = argv[7];
+        printf("COMMAND\n%s %s %lu %lu %lu %lu %lu %s\n", argv[0], bp_name, config.M2, config.T, config.B, config.Lmin, config.Lmax, trace_file);
+    }
+    else {
         if(argc != 7) {
-            printf("Error: %s wrong number of inputs:%d\n", params.bp_name, argc-1);
+            printf("Error: %s wrong number of inputs:%d\n", bp_name, argc-1);
             exit(EXIT_FAILURE);
         }
-        params.K = strtoul(argv[2], NULL, 10);
-        params.M1 = strtoul(argv[3], NULL, 10);
-        params.N = strtoul(argv[4], NULL, 10);
-        params.M2 = strtoul(argv[5], NULL, 10);
+        config.K = strtoul(argv[2], NULL, 10);
+        config.M1 = strtoul(argv[3], NULL, 10);
+        config.N = strtoul(argv[4], NULL, 10);
+        config.M2 = strtoul(argv[5], NULL, 10);
         trace_file = argv[6];
-        printf("COMMAND\n%s %s %lu %lu %lu %lu %s\n", argv[0], params.bp_name, params.K, params.M1, params.N, params.M2, trace_file);
-        init_predictor(&params);
+        printf("COMMAND\n%s %s %lu %lu %lu %lu %s\n", argv[0], bp_name, config.K, config.M1, config.N, config.M2, trace_file);
     }
-    else {
-        printf("Error: Wrong branch predictor name:%s\n", params.bp_name);
+
+    if (nbps > 1 && config.type != BP_HYBRID && config.type != BP_TOURNAMENT) {
+        printf("Error: --policy all needs hybrid or tournament\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strchr(trace_file, ',') != NULL) {
+        smt_threads = parse_smt(trace_file, weight_list, smt_paths, smt_weights);
+        if (smt_threads < 0) {
+            printf("Error: Wrong SMT traces or weights (at most %d threads)\n", SMT_MAX_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        if (nbps > 1) {
+            printf("Error: --policy all cannot run SMT traces\n");
+            exit(EXIT_FAILURE);
+        }
+        if (quantum && weight_list != NULL) {
+            printf("Error: --quantum and --weights cannot be combined\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int t = 0; quantum && t < smt_threads; t++) smt_weights[t] = (unsigned int)quantum;
+    }
+    else if (weight_list != NULL || private_history || quantum || flush) {
+        printf("Error: --weights, --history, --quantum and --flush need several comma-separated traces\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nbps; i++) {
+        config.policy = nbps > 1 ? (bp_update_policy)i : policy;
+        bps[i] = bp_create(&config);
+        if (bps[i] == NULL) {
+            printf("Error: Invalid %s configuration\n", bp_name);
+            destroy_all(bps, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((cache_dir || resume_path) && (smt_threads > 0 || strncmp(trace_file, RING_PREFIX, strlen(RING_PREFIX)) == 0)) {
+        printf("Error: --cache and --resume need a single trace file\n");
+        destroy_all(bps, nbps);
+        exit(EXIT_FAILURE);
+    }
+    if (cache_dir && resume_path) {
+        printf("Error: --cache and --resume cannot be combined\n");
+        destroy_all(bps, nbps);
+        exit(EXIT_FAILURE);
+    }
+    if ((log_path || annotate_path || undo_path) && (cache_dir || nbps > 1 || smt_threads > 0)) {
+        printf("Error: Branch logs need a single predictor and trace, without --cache\n");
+        destroy_all(bps, nbps);
+        exit(EXIT_FAILURE);
+    }
+    if (progress_interval >= 0 && (smt_threads > 0 || strncmp(trace_file, RING_PREFIX, strlen(RING_PREFIX)) == 0)) {
+        printf("Error: --progress needs a single trace file\n");
+        destroy_all(bps, nbps);
         exit(EXIT_FAILURE);
     }
+    // A binary trace states its size up front
+    trace_known = smt_threads == 0 && trace_read_stats(trace_file, &trace_info) == 0;
+    if (compare_spec || disagreements_path) {
+        // B inherits --loop, --policy and --isa unless its spec sets them
+        bp_config other;
+        char *spec = strdup(compare_spec ? compare_spec : "");
+        memset(&other, 0, sizeof(other));
+        other.E = loop_bits;
+        other.policy = policy;
+        other.isa = isa;
+        if (!compare_spec || nbps > 1 || smt_threads > 0 || cache_dir || resume_path) {
+            printf("Error: %s\n", !compare_spec ? "--disagreements needs --compare" :
+                   "--compare needs a single predictor and trace, without --cache or --resume");
+            free(spec);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (!spec || parse_spec(spec, &other) != 0 || (logs.other = bp_create(&other)) == NULL) {
+            printf("Error: Invalid compare configuration:%s\n", compare_spec);
+            free(spec);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        free(spec);
+        if ((logs.comparison = compare_create(trace_known ? trace_info.unique_pcs : 0)) == NULL ||
+            (disagreements_path && (logs.disagreements = mlog_open(disagreements_path, "BPDS", 0)) == NULL)) {
+            printf("Error: Unable to create %s\n", logs.comparison ? disagreements_path : "comparison");
+            compare_destroy(logs.comparison);
+            bp_destroy(logs.other);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((log_path && (logs.mispredictions = mlog_open(log_path, "BPML", 0)) == NULL) ||
+        (annotate_path && (logs.annotated = mlog_open(annotate_path, "BPAT", sizeof(mlog_record))) == NULL)) {
+        printf("Error: Unable to create %s\n", logs.mispredictions || !log_path ? annotate_path : log_path);
+        destroy_all(bps, nbps);
+        exit(EXIT_FAILURE);
+    }
+    if (undo_path && (logs.undo = undo_create(undo_path, bps[0], undo_interval)) == NULL) {
+        printf("Error: Unable to create %s\n", undo_path);
+        destroy_all(bps, nbps);
+        exit(EXIT_FAILURE);
+    }
+    // Every instruction set computes the same results
+    config.policy = nbps > 1 ? BP_NUM_POLICIES : policy;
+    config.isa = BP_ISA_AUTO;
+    config_key = cache_hash(&config, sizeof(config), 0);
+    if (cache_dir) {
+        // The key covers trace content, every configuration and the simulator itself
+        uint64_t parts[3];
+        parts[0] = config_key;
+        if (cache_file_hash(trace_file, 1, &parts[1]) != 0) {
+            printf("Error: Unable to open file %s\n", trace_file);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (cache_file_hash("/proc/self/exe", 0, &parts[2]) == 0) {
+            cache_key = cache_hash(parts, sizeof(parts), 0);
+            fflush(stdout);
+            if (cache_lookup(cache_dir, cache_key, stdout) == 0) {
+                destroy_all(bps, nbps);
+                return 0;
+            }
+            out = open_memstream(&cache_text, &cache_len);
+            if (out == NULL) out = stdout;
+        }
+    }
+
+    if (progress_interval >= 0) {
+        // A text trace is scanned first to know its length
+        if (!trace_known && !resume_path && trace_scan(trace_file, &trace_info) != 0) {
+            printf("Error: Unable to scan trace %s\n", trace_file);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        memset(&run_progress, 0, sizeof(run_progress));
+        run_progress.total = trace_info.records;
+        run_progress.interval = progress_interval;
+        gettimeofday(&run_progress.start, NULL);
+        run_progress.last = run_progress.start;
+        report = &run_progress;
+    }
 
-    // Open branch trace file
-    FP = fopen(trace_file, "r");
-    if(FP == NULL) {
-        printf("Error: Unable to open file %s\n", trace_file);
-        free_predictor(&params);
+    if (smt_threads > 0) {
+        // Interleave the traces as hardware threads sharing the tables
+        smt_options options = { smt_weights, private_history, (unsigned int)flush, quantum != 0 };
+        if (smt_run(bps[0], smt_paths, smt_threads, &options, smt_stats, &slices, &nslices) != 0) {
+            free(slices);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strncmp(trace_file, RING_PREFIX, strlen(RING_PREFIX)) == 0) {
+        // Simulate records in place as the producer publishes them
+        const char *ring_name = trace_file + strlen(RING_PREFIX);
+        bp_ring *ring = bp_ring_open(ring_name, RING_CAPACITY);
+        if(ring == NULL) {
+            printf("Error: Unable to open ring %s\n", ring_name);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (jit_dir) jit_all(bps, nbps, jit_dir);
+        size_t index, count;
+        while ((count = bp_ring_peek(ring, &index)) != 0) {
+            batch_all(bps, nbps, ring->addrs + index, ring->taken + index, count, &logs);
+            bp_ring_release(ring, count);
+        }
+        bp_ring_destroy(ring, ring_name);
+    }
+    else if (resume_path) {
+        // Continue from the saved predictors and simulate only what was appended
+        bp_trace trace;
+        size_t offset, end;
+        if (resume_load(resume_path, trace_file, config_key, bps, nbps, &offset) < 0) {
+            fprintf(stderr, "Warning: State %s does not match this configuration and trace, starting over\n",
+                    resume_path);
+        }
+        if (jit_dir) jit_all(bps, nbps, jit_dir);
+        if (trace_load_from(trace_file, offset, &trace, &end) != 0) {
+            printf("Error: Unable to read trace %s from byte %zu\n", trace_file, offset);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (report) report->total = trace.count;
+        simulate(bps, nbps, &trace, &logs, report);
+        fprintf(stderr, "Resumed at byte %zu, simulated %zu new branches\n", offset, trace.count);
+        trace_free(&trace);
+        if (resume_save(resume_path, trace_file, config_key, bps, nbps, end) != 0) {
+            fprintf(stderr, "Warning: Unable to save state %s\n", resume_path);
+        }
+    }
+    else if (trace_is_binary(trace_file)) {
+        // Binary traces decode into arrays in one go
+        bp_trace trace;
+        if (trace_load(trace_file, &trace) != 0) {
+            printf("Error: Unable to read binary trace %s\n", trace_file);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (jit_dir) jit_all(bps, nbps, jit_dir);
+        simulate(bps, nbps, &trace, &logs, report);
+        trace_free(&trace);
+    }
+    else {
+        // Open branch trace file
+        FP = fopen(trace_file, "r");
+        if(FP == NULL) {
+            printf("Error: Unable to open file %s\n", trace_file);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+        if (jit_dir) jit_all(bps, nbps, jit_dir);
+
+        // Simulate predictions in batches of branches
+        char str[2];
+        size_t count = 0;
+        int fields;
+        while((fields = fscanf(FP, "%lx %1s", &addr, str)) == 2) {
+            addrs[count] = addr;
+            outcomes[count] = str[0] == 't';
+            if (++count == TRACE_BATCH) {
+                batch_all(bps, nbps, addrs, outcomes, count, &logs);
+                if (report) progress_update(report, count, 0);
+                count = 0;
+            }
+        }
+        batch_all(bps, nbps, addrs, outcomes, count, &logs);
+        if (report) progress_update(report, count, 0);
+        fclose(FP);
+        if (fields != EOF) {
+            printf("Error: Malformed trace %s\n", trace_file);
+            destroy_all(bps, nbps);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (report) progress_update(report, 0, 1);
+
+    int log_failed = 0;
+    if (logs.mispredictions) log_failed |= mlog_close(logs.mispredictions) != 0;
+    if (logs.annotated) log_failed |= mlog_close(logs.annotated) != 0;
+    if (logs.disagreements) log_failed |= mlog_close(logs.disagreements) != 0;
+    if (logs.undo) log_failed |= undo_close(logs.undo, bps[0]) != 0;
+    if (log_failed) {
+        printf("Error: Unable to write branch logs\n");
+        destroy_all(bps, nbps);
         exit(EXIT_FAILURE);
     }
 
-    // Simulate predictions for each branch
-    char str[2];
-    while(fscanf(FP, "%lx %s", &addr, str) != EOF) {
-        outcome = str[0];
-        predictions++;
-        int correct = 0;
-        if (strcmp(params.bp_name, "bimodal") == 0) {
-            correct = bimodal_predict(&params, addr, outcome);
-        } else if (strcmp(params.bp_name, "gshare") == 0) {
-            correct = gshare_predict(&params, addr, outcome);
-        } else if (strcmp(params.bp_name, "hybrid") == 0) {
-            correct = hybrid_predict(&params, addr, outcome);
-        }
-        if (!correct) mispredictions++;
-    }
-
-    // Print summary and table contents
-    printf("OUTPUT\n");
-    printf("Number of predictions: %u\n", predictions);
-    printf("Number of mispredictions: %u\n", mispredictions);
-    printf("Misprediction rate: %.2f%%\n", (double)mispredictions / predictions * 100);
-    print_final_contents(&params);
-    fclose(FP);
+    // Print summary and table contents, one section per policy in a sweep
+    for (int i = 0; i < nbps; i++) {
+        if (nbps > 1) fprintf(out, "POLICY %s\n", bp_policy_name(bp_get_config(bps[i])->policy));
+        bp_get_stats(bps[i], &stats);
+        fprintf(out, "OUTPUT\n");
+        print_rates(out, &stats);
+        for (int t = 0; t < smt_threads; t++) {
+            fprintf(out, "THREAD %d %s\n", t, smt_paths[t]);
+            print_rates(out, &smt_stats[t]);
+        }
+        if (quantum) {
+            fprintf(out, "SLICES\nslice thread predictions mispredictions rate\n");
+            for (size_t n = 0; n < nslices; n++) {
+                fprintf(out, "%zu %d %lu %lu %.2f%%\n", n, slices[n].thread, slices[n].predictions, slices[n].mispredictions,
+                            (double)slices[n].mispredictions / slices[n].predictions * 100);
+            }
+        }
+        if (logs.other) {
+            // Table contents of two predictors would bury the comparison
+            bp_get_stats(logs.other, &stats);
+            fprintf(out, "COMPARE %s\n", compare_spec);
+            print_rates(out, &stats);
+            compare_print(logs.comparison, out);
+            continue;
+        }
+        bp_print_contents(bps[i], out);
+    }
+    destroy_all(bps, nbps);
+    if (logs.other) bp_destroy(logs.other);
+    compare_destroy(logs.comparison);
+    free(slices);
+
+    // A miss stores the result it just produced
+    if (out != stdout) {
+        fclose(out);
+        fwrite(cache_text, 1, cache_len, stdout);
+        if (cache_store(cache_dir, cache_key, cache_text, cache_len, cache_limit) != 0) {
+            fprintf(stderr, "Warning: Unable to write cache %s\n", cache_dir);
+        }
+        free(cache_text);
+    }
 
     return 0;
 }
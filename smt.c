@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bp.h"
+#include "smt.h"
+#include "trace.h"
+
+#define SMT_CHUNK 4096
+#define SMT_QUEUE_DEPTH 4
+
+ /**
+ * SMT mode: several traces, one per hardware thread, interleaved branch by
+ * branch into a single predictor so the threads compete for its tables.
+ *
+ * Every trace has its own reader thread parsing ahead into a small queue of
+ * chunks, so the merge only waits when a reader is genuinely behind. A binary
+ * trace (see trace.h) is decoded whole before the run and its reader copies
+ * the chunks out of the arrays. The merge visits the threads round robin and
+ * takes weight branches from each per turn; a thread whose trace ends drops
+ * out. With private history each thread's global history is swapped in
+ * (bp_switch_thread) before its branches, otherwise all threads shift into
+ * the same history. Equal weights of Q branches model a time-sliced single
+ * core instead, optionally flushing predictor state at each context switch.
+ */
+
+typedef struct smt_chunk{
+    unsigned long int addrs[SMT_CHUNK];
+    unsigned char     taken[SMT_CHUNK];
+    size_t            count;
+}smt_chunk;
+
+typedef struct smt_reader{
+    FILE              *fp;              /* text trace, NULL for a binary one */
+    bp_trace          trace;            /* binary trace */
+    size_t            next;             /* next record of trace to copy */
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    smt_chunk         chunks[SMT_QUEUE_DEPTH];
+    unsigned long int head;             /* next chunk to consume */
+    unsigned long int tail;             /* next chunk to fill */
+    int               done;
+    int               malformed;        /* stopped at a line that does not parse */
+    smt_chunk         *current;         /* head chunk, touched only by the merge */
+    size_t            pos;              /* next record in current */
+}smt_reader;
+
+static void *reader_thread(void *arg) {
+    smt_reader *r = (smt_reader*)arg;
+    unsigned long int addr;
+    char str[2];
+    int eof = 0;
+    while (!eof) {
+        pthread_mutex_lock(&r->lock);
+        while (r->tail - r->head == SMT_QUEUE_DEPTH) pthread_cond_wait(&r->cond, &r->lock);
+        smt_chunk *chunk = &r->chunks[r->tail % SMT_QUEUE_DEPTH];
+        pthread_mutex_unlock(&r->lock);
+
+        // The slot at tail belongs to the reader until tail moves past it
+        chunk->count = 0;
+        if (!r->fp) {
+            size_t n = r->trace.count - r->next < SMT_CHUNK ? r->trace.count - r->next : SMT_CHUNK;
+            memcpy(chunk->addrs, r->trace.addrs + r->next, n * sizeof(unsigned long int));
+            memcpy(chunk->taken, r->trace.taken + r->next, n);
+            chunk->count = n;
+            r->next += n;
+            eof = r->next == r->trace.count;
+        }
+        while (r->fp && chunk->count < SMT_CHUNK) {
+            int fields = fscanf(r->fp, "%lx %1s", &addr, str);
+            if (fields != 2) {
+                // A line that does not parse is not consumed, so stop there
+                r->malformed = fields != EOF;
+                eof = 1;
+                break;
+            }
+            chunk->addrs[chunk->count] = addr;
+            chunk->taken[chunk->count] = str[0] == 't';
+            chunk->count++;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if (chunk->count) r->tail++;
+        r->done = eof;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+ /**
+ * Opens paths' trace for r: a text trace as a stream, a binary one decoded
+ * into memory. Returns 0, or -1 (after printing an error) on failure.
+ */
+
+static int reader_open(smt_reader *r, const char *path) {
+    if (trace_is_binary(path)) {
+        if (trace_load(path, &r->trace) == 0) return 0;
+        printf("Error: Unable to read binary trace %s\n", path);
+        return -1;
+    }
+    r->fp = fopen(path, "r");
+    if (r->fp) return 0;
+    printf("Error: Unable to open file %s\n", path);
+    return -1;
+}
+
+static void reader_close(smt_reader *r) {
+    if (r->fp) fclose(r->fp);
+    trace_free(&r->trace);
+}
+
+ /**
+ * Returns the chunk holding the reader's next record, waiting for the reader
+ * if needed, or NULL once the trace is exhausted.
+ */
+
+static smt_chunk *reader_chunk(smt_reader *r) {
+    pthread_mutex_lock(&r->lock);
+    if (r->head != r->tail && r->pos == r->chunks[r->head % SMT_QUEUE_DEPTH].count) {
+        r->head++;
+        r->pos = 0;
+        pthread_cond_signal(&r->cond);
+    }
+    while (r->head == r->tail && !r->done) pthread_cond_wait(&r->cond, &r->lock);
+    smt_chunk *chunk = r->head != r->tail ? &r->chunks[r->head % SMT_QUEUE_DEPTH] : NULL;
+    pthread_mutex_unlock(&r->lock);
+    return chunk;
+}
+
+ /**
+ * Appends a slice to the growable array *slices. Returns 0, or -1 if memory
+ * is exhausted.
+ */
+
+static int add_slice(smt_slice **slices, size_t *nslices, size_t *capacity, const smt_slice *slice) {
+    if (*nslices == *capacity) {
+        size_t grown = *capacity ? 2 * *capacity : 256;
+        smt_slice *more = (smt_slice*)realloc(*slices, grown * sizeof(smt_slice));
+        if (!more) return -1;
+        *slices = more;
+        *capacity = grown;
+    }
+    (*slices)[(*nslices)++] = *slice;
+    return 0;
+}
+
+ /**
+ * Runs the interleaved simulation of paths[0..threads-1] on bp, taking
+ * weights[i] consecutive branches from thread i per turn. Whenever the turn
+ * passes to a different thread, options->flush (if any) is applied first,
+ * modelling a context switch. Per-thread statistics go to per_thread; the
+ * predictor's own statistics hold the total. With record_slices every turn is
+ * returned in *slices (to be freed by the caller).
+ * Returns 0 on success, -1 (after printing an error) if a trace cannot be read
+ * or is malformed, or memory is exhausted.
+ */
+
+int smt_run(bp_predictor *bp, char *const *paths, int threads, const smt_options *options,
+            bp_stats *per_thread, smt_slice **slices, size_t *nslices) {
+    smt_reader *readers = (smt_reader*)calloc((size_t)threads, sizeof(smt_reader));
+    size_t capacity = 0;
+    int status = 0;
+    *slices = NULL;
+    *nslices = 0;
+    if (!readers) {
+        printf("Error: Out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (reader_open(&readers[i], paths[i]) != 0) {
+            for (int j = 0; j < i; j++) reader_close(&readers[j]);
+            free(readers);
+            return -1;
+        }
+    }
+    if ((options->private_history && bp_set_threads(bp, (unsigned int)threads) != 0) ||
+        (options->flush && bp_track_dirty(bp) != 0)) {
+        printf("Error: Out of memory\n");
+        for (int i = 0; i < threads; i++) reader_close(&readers[i]);
+        free(readers);
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&readers[i].lock, NULL);
+        pthread_cond_init(&readers[i].cond, NULL);
+        pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]);
+        memset(&per_thread[i], 0, sizeof(per_thread[i]));
+    }
+
+    int active = threads, last = -1;
+    int finished[SMT_MAX_THREADS] = { 0 };
+    while (active) {
+        for (int i = 0; i < threads; i++) {
+            if (finished[i]) continue;
+            smt_reader *r = &readers[i];
+            smt_slice slice = { i, 0, 0 };
+            for (unsigned int n = 0; n < options->weights[i]; n++) {
+                if (!r->current || r->pos == r->current->count) r->current = reader_chunk(r);
+                if (!r->current) {
+                    finished[i] = 1;
+                    active--;
+                    break;
+                }
+                // Switch only once the thread is known to have a branch to run
+                if (n == 0) {
+                    if (options->flush && last >= 0 && last != i) bp_flush(bp, options->flush);
+                    if (options->private_history) bp_switch_thread(bp, (unsigned int)i);
+                    last = i;
+                }
+                int correct = bp_step(bp, r->current->addrs[r->pos], r->current->taken[r->pos]);
+                r->pos++;
+                slice.predictions++;
+                slice.mispredictions += !correct;
+            }
+            per_thread[i].predictions += slice.predictions;
+            per_thread[i].mispredictions += slice.mispredictions;
+            if (options->record_slices && slice.predictions && status == 0 &&
+                add_slice(slices, nslices, &capacity, &slice) != 0) {
+                printf("Error: Out of memory\n");
+                status = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_join(readers[i].thread, NULL);
+        pthread_mutex_destroy(&readers[i].lock);
+        pthread_cond_destroy(&readers[i].cond);
+        reader_close(&readers[i]);
+        if (readers[i].malformed) {
+            printf("Error: Malformed trace %s\n", paths[i]);
+            status = -1;
+        }
+    }
+    free(readers);
+    return status;
+}
@@ -0,0 +1,30 @@
+#ifndef SMT_H
+#define SMT_H
+
+#include <stddef.h>
+#include "bp.h"
+
+#define SMT_MAX_THREADS 16
+
+typedef struct smt_options{
+    const unsigned int *weights;        /* consecutive branches per turn, per thread */
+    int                private_history; /* per-thread global history instead of a shared one */
+    unsigned int       flush;           /* bp_flush mask applied on every switch, 0 for none */
+    int                record_slices;   /* collect statistics for every turn */
+}smt_options;
+
+ /**
+ * One turn (time slice) of a thread: the branches it ran before the next
+ * switch.
+ */
+
+typedef struct smt_slice{
+    int               thread;
+    unsigned long int predictions;
+    unsigned long int mispredictions;
+}smt_slice;
+
+int smt_run(bp_predictor *bp, char *const *paths, int threads, const smt_options *options,
+            bp_stats *per_thread, smt_slice **slices, size_t *nslices);
+
+#endif
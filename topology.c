@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+#define TOPOLOGY_SYSFS "/sys/devices/system/node"
+
+ /**
+ * Parses a sysfs CPU list such as "0-3,8-11" into set.
+ * Returns the number of CPUs, or -1 if the list is malformed.
+ */
+
+static int parse_cpulist(const char *p, cpu_set_t *set) {
+    int count = 0;
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || first < 0) return -1;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+            count++;
+        }
+        if (*p == ',') p++;
+    }
+    return count;
+}
+
+ /**
+ * Reads the memory nodes and their CPUs from sysfs, keeping only CPUs this
+ * process may run on; nodes left without CPUs are skipped. Without NUMA
+ * information the machine counts as one node holding every CPU this process
+ * may run on.
+ * Returns the number of nodes found (at least 1).
+ */
+
+int topology_detect(topology *topo) {
+    char path[256], line[4096];
+    cpu_set_t allowed;
+    memset(topo, 0, sizeof(*topo));
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) CPU_ZERO(&allowed);
+    for (int node = 0; node < 1024 && topo->nodes < TOPOLOGY_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/node%d/cpulist", node);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        int count = fgets(line, sizeof(line), fp) ? parse_cpulist(line, &topo->cpus[topo->nodes]) : -1;
+        fclose(fp);
+        if (count > 0 && CPU_COUNT(&allowed)) {
+            CPU_AND(&topo->cpus[topo->nodes], &topo->cpus[topo->nodes], &allowed);
+            count = CPU_COUNT(&topo->cpus[topo->nodes]);
+        }
+        if (count > 0) topo->cpu_count[topo->nodes++] = count;
+    }
+    if (topo->nodes == 0) {
+        topo->nodes = 1;
+        topo->cpus[0] = allowed;
+        topo->cpu_count[0] = CPU_COUNT(&allowed);
+    }
+    return topo->nodes;
+}
+
+ /**
+ * Pins the calling thread, worker number worker of a pool, to one core.
+ * Workers are dealt out across nodes round robin and then across each node's
+ * cores, so any pool size spreads evenly over the sockets. Memory the worker
+ * touches first is then placed on its node by the kernel's first-touch rule.
+ * Returns the worker's node.
+ */
+
+int topology_pin_worker(const topology *topo, int worker) {
+    int node = worker % topo->nodes;
+    int slot = (worker / topo->nodes) % (topo->cpu_count[node] ? topo->cpu_count[node] : 1);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &topo->cpus[node]) || slot--) continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        break;
+    }
+    return node;
+}
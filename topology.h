@@ -0,0 +1,21 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>     /* cpu_set_t needs _GNU_SOURCE before the first system header */
+
+#define TOPOLOGY_MAX_NODES 16
+
+ /**
+ * NUMA layout of the machine: the CPUs of each memory node, in order.
+ */
+
+typedef struct topology{
+    int       nodes;
+    int       cpu_count[TOPOLOGY_MAX_NODES];
+    cpu_set_t cpus[TOPOLOGY_MAX_NODES];
+}topology;
+
+int topology_detect(topology *topo);
+int topology_pin_worker(const topology *topo, int worker);
+
+#endif
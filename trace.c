@@ -0,0 +1,617 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "cache.h"
+#include "trace.h"
+
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+ /**
+ * Counts the newlines in n bytes, which sizes the record arrays before
+ * parsing. The loop vectorizes, so it is built once per instruction set and
+ * the widest one the CPU supports is picked at the first count (or forced by
+ * trace_set_isa); off x86 there is only the scalar build. Counts are kept
+ * per block in 32 bits, which the vector code accumulates without widening
+ * every byte to 64.
+ */
+
+static inline __attribute__((always_inline)) size_t count_lines_body(const char *p, size_t n) {
+    size_t lines = 0;
+    while (n > 0) {
+        size_t len = n < 65536 ? n : 65536;
+        unsigned int block = 0;
+        for (size_t i = 0; i < len; i++) block += p[i] == '\n';
+        lines += block;
+        p += len;
+        n -= len;
+    }
+    return lines;
+}
+
+static size_t count_lines_scalar(const char *p, size_t n) {
+    return count_lines_body(p, n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.2")))
+static size_t count_lines_sse42(const char *p, size_t n) {
+    return count_lines_body(p, n);
+}
+
+__attribute__((target("avx2")))
+static size_t count_lines_avx2(const char *p, size_t n) {
+    return count_lines_body(p, n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t count_lines_avx512(const char *p, size_t n) {
+    return count_lines_body(p, n);
+}
+
+#endif
+
+typedef size_t (*count_lines_kernel)(const char *p, size_t n);
+
+static count_lines_kernel count_lines;
+static pthread_once_t count_lines_once = PTHREAD_ONCE_INIT;
+
+static count_lines_kernel count_lines_for(bp_isa isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    return isa == BP_ISA_AVX512 ? count_lines_avx512 : isa == BP_ISA_AVX2 ? count_lines_avx2 :
+           isa == BP_ISA_SSE42 ? count_lines_sse42 : count_lines_scalar;
+#else
+    return count_lines_scalar;
+#endif
+}
+
+static void count_lines_auto(void) {
+    __atomic_store_n(&count_lines, count_lines_for(bp_isa_best()), __ATOMIC_RELAXED);
+}
+
+ /**
+ * Selects the line counting kernel; BP_ISA_AUTO takes the widest supported.
+ * The automatic choice is made once, the first time either this or
+ * trace_count_lines runs, so a forced kernel is never replaced by it and
+ * parallel callers need no setup.
+ * Returns 0 on success, -1 if the CPU does not support isa.
+ */
+
+int trace_set_isa(bp_isa isa) {
+    pthread_once(&count_lines_once, count_lines_auto);
+    if (isa == BP_ISA_AUTO) isa = bp_isa_best();
+    if (!bp_isa_supported(isa)) return -1;
+    __atomic_store_n(&count_lines, count_lines_for(isa), __ATOMIC_RELAXED);
+    return 0;
+}
+
+ /**
+ * Counts the newlines in n bytes with the selected kernel.
+ */
+
+size_t trace_count_lines(const char *p, size_t n) {
+    pthread_once(&count_lines_once, count_lines_auto);
+    return __atomic_load_n(&count_lines, __ATOMIC_RELAXED)(p, n);
+}
+
+ /**
+ * Parses "<hex address> <t|n>" lines from text into the record arrays.
+ * Returns the number of records parsed, or (size_t)-1 on a malformed line or
+ * more than capacity records.
+ */
+
+size_t trace_parse(const char *p, const char *end, unsigned long int *addrs, unsigned char *taken, size_t capacity) {
+    size_t n = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+        if (p == end) break;
+        if (end - p > 1 && p[0] == '0' && (p[1] | 0x20) == 'x') p += 2;
+        unsigned long int addr = 0;
+        int digit, digits = 0;
+        while (p < end && (digit = hex_value(*p)) >= 0) {
+            addr = (addr << 4) | digit;
+            p++;
+            digits++;
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (!digits || p == end || n == capacity) return (size_t)-1;
+        addrs[n] = addr;
+        taken[n] = *p == 't';
+        n++;
+        while (p < end && *p != '\n') p++;
+    }
+    return n;
+}
+
+ /**
+ * Encodes count records as the inflated contents of a binary trace block
+ * (see trace.h) into out, which must hold TRACE_ENCODED_BOUND(count) bytes.
+ * Returns the number of bytes written.
+ */
+
+size_t trace_encode(const unsigned long int *addrs, const unsigned char *taken, size_t count, unsigned char *out) {
+    size_t bitmap = (count + 7) / 8, n = bitmap;
+    unsigned long int previous = 0;
+    memset(out, 0, bitmap);
+    for (size_t i = 0; i < count; i++) {
+        out[i / 8] |= (unsigned char)((taken[i] != 0) << (i % 8));
+        int64_t delta = (int64_t)(addrs[i] - previous);
+        uint64_t value = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        previous = addrs[i];
+        do {
+            out[n] = (unsigned char)(value & 0x7f);
+            value >>= 7;
+            out[n++] |= value ? 0x80 : 0;
+        } while (value);
+    }
+    return n;
+}
+
+ /**
+ * Decodes the inflated contents of a binary trace block holding count
+ * records. Returns 0, or -1 if raw does not hold exactly count records.
+ */
+
+int trace_decode(const unsigned char *raw, size_t raw_size, size_t count, unsigned long int *addrs, unsigned char *taken) {
+    size_t bitmap = (count + 7) / 8, n = bitmap;
+    unsigned long int previous = 0;
+    if (raw_size < bitmap) return -1;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t value = 0;
+        unsigned int shift = 0;
+        do {
+            if (n == raw_size || shift > 63) return -1;
+            value |= (uint64_t)(raw[n] & 0x7f) << shift;
+            shift += 7;
+        } while (raw[n++] & 0x80);
+        previous += (unsigned long int)((value >> 1) ^ (0 - (value & 1)));
+        addrs[i] = previous;
+        taken[i] = (raw[i / 8] >> (i % 8)) & 1;
+    }
+    return n == raw_size ? 0 : -1;
+}
+
+ /**
+ * Returns the length of the next block of a text trace starting at p, with
+ * left > 0 bytes to go: TRACE_BLOCK bytes extended to the end of their line.
+ */
+
+size_t trace_cut(const char *p, size_t left) {
+    size_t size = left < TRACE_BLOCK ? left : TRACE_BLOCK;
+    const char *newline = (const char*)memchr(p + size - 1, '\n', left - size + 1);
+    return newline ? (size_t)(newline - p) + 1 : left;
+}
+
+ /**
+ * Sets stats to those of one block of count records (all but unique_pcs,
+ * which needs the addresses of the whole trace, see trace_pcs_add).
+ */
+
+void trace_stats_block(trace_stats *stats, const unsigned long int *addrs, const unsigned char *taken, size_t count) {
+    memset(stats, 0, sizeof(*stats));
+    stats->records = count;
+    for (size_t i = 0; i < count; i++) stats->taken += taken[i] != 0;
+    stats->hash = cache_hash(taken, count, cache_hash(addrs, count * sizeof(unsigned long int), count));
+}
+
+ /**
+ * Appends the statistics of the next block to those of the blocks before it.
+ */
+
+void trace_stats_merge(trace_stats *total, const trace_stats *block) {
+    uint64_t chain[2] = { total->hash, block->hash };
+    total->records += block->records;
+    total->taken += block->taken;
+    total->hash = cache_hash(chain, sizeof(chain), 0);
+}
+
+static size_t pc_slot(unsigned long int addr, size_t capacity) {
+    return (size_t)(((addr >> 2) * 0x9E3779B97F4A7C15ULL) >> 20) & (capacity - 1);
+}
+
+static int compare_pcs(const void *x, const void *y) {
+    unsigned long int a = *(const unsigned long int*)x, b = *(const unsigned long int*)y;
+    return a < b ? -1 : a > b;
+}
+
+ /**
+ * Adds the addresses of count records to set. They go through an
+ * open-addressing table first (0 marks a free slot, so address 0 is noted
+ * apart), and only the distinct ones are sorted and merged.
+ * Returns 0, or -1 if memory is exhausted.
+ */
+
+int trace_pcs_add(trace_pcs *set, const unsigned long int *addrs, size_t count) {
+    size_t capacity = 1024, used = 0;
+    int zero = 0;
+    unsigned long int *slots = (unsigned long int*)calloc(capacity, sizeof(unsigned long int));
+    if (!slots) return -1;
+    for (size_t i = 0; i < count; i++) {
+        unsigned long int addr = addrs[i];
+        if (addr == 0) {
+            zero = 1;
+            continue;
+        }
+        size_t s = pc_slot(addr, capacity);
+        while (slots[s] && slots[s] != addr) s = (s + 1) & (capacity - 1);
+        if (slots[s]) continue;
+        slots[s] = addr;
+        if (2 * ++used <= capacity) continue;
+        // Rehash into twice the slots
+        unsigned long int *grown = (unsigned long int*)calloc(2 * capacity, sizeof(unsigned long int));
+        if (!grown) {
+            free(slots);
+            return -1;
+        }
+        for (size_t j = 0; j < capacity; j++) {
+            if (!slots[j]) continue;
+            size_t t = pc_slot(slots[j], 2 * capacity);
+            while (grown[t]) t = (t + 1) & (2 * capacity - 1);
+            grown[t] = slots[j];
+        }
+        free(slots);
+        slots = grown;
+        capacity *= 2;
+    }
+
+    trace_pcs distinct = { (unsigned long int*)malloc((used + zero + 1) * sizeof(unsigned long int)), 0 };
+    if (!distinct.pcs) {
+        free(slots);
+        return -1;
+    }
+    if (zero) distinct.pcs[distinct.count++] = 0;
+    for (size_t s = 0; s < capacity; s++) {
+        if (slots[s]) distinct.pcs[distinct.count++] = slots[s];
+    }
+    free(slots);
+    qsort(distinct.pcs, distinct.count, sizeof(unsigned long int), compare_pcs);
+    return trace_pcs_merge(set, &distinct);
+}
+
+ /**
+ * Merges other into set, leaving other empty.
+ * Returns 0, or -1 if memory is exhausted (other is emptied regardless).
+ */
+
+int trace_pcs_merge(trace_pcs *set, trace_pcs *other) {
+    if (!set->pcs) {
+        *set = *other;
+        memset(other, 0, sizeof(*other));
+        return 0;
+    }
+    unsigned long int *pcs = (unsigned long int*)malloc((set->count + other->count + 1) * sizeof(unsigned long int));
+    size_t i = 0, j = 0, n = 0;
+    if (!pcs) {
+        trace_pcs_free(other);
+        return -1;
+    }
+    while (i < set->count || j < other->count) {
+        if (j == other->count || (i < set->count && set->pcs[i] < other->pcs[j])) pcs[n++] = set->pcs[i++];
+        else if (i == set->count || other->pcs[j] < set->pcs[i]) pcs[n++] = other->pcs[j++];
+        else {
+            pcs[n++] = set->pcs[i++];
+            j++;
+        }
+    }
+    free(set->pcs);
+    trace_pcs_free(other);
+    set->pcs = pcs;
+    set->count = n;
+    return 0;
+}
+
+void trace_pcs_free(trace_pcs *set) {
+    free(set->pcs);
+    memset(set, 0, sizeof(*set));
+}
+
+ /**
+ * Fills trace (already mapped for header->stats.records records) from the
+ * blocks of a binary trace, checking every checksum and the statistics.
+ * Returns 0, or -1 if the data is truncated or corrupt.
+ */
+
+static int load_binary(const unsigned char *data, size_t size, const trace_header *header, bp_trace *trace) {
+    size_t at = sizeof(trace_header);
+    unsigned char *raw = NULL;
+    size_t capacity = 0;
+    trace_stats stats, block_stats;
+    int ok = 1;
+    memset(&stats, 0, sizeof(stats));
+    for (uint64_t b = 0; b < header->blocks && ok; b++) {
+        trace_block block;
+        if (size - at < sizeof(block)) break;
+        memcpy(&block, data + at, sizeof(block));
+        at += sizeof(block);
+        if (block.size > size - at || block.records > header->stats.records - trace->count ||
+            crc32(0, data + at, block.size) != block.crc) break;
+        if (block.raw_size > capacity) {
+            free(raw);
+            capacity = block.raw_size;
+            if (!(raw = (unsigned char*)malloc(capacity))) break;
+        }
+        uLongf length = block.raw_size;
+        ok = uncompress(raw, &length, data + at, block.size) == Z_OK && length == block.raw_size &&
+             crc32(0, raw, block.raw_size) == block.raw_crc &&
+             trace_decode(raw, block.raw_size, block.records, trace->addrs + trace->count, trace->taken + trace->count) == 0;
+        trace_stats_block(&block_stats, trace->addrs + trace->count, trace->taken + trace->count, block.records);
+        trace_stats_merge(&stats, &block_stats);
+        trace->count += block.records;
+        at += block.size;
+    }
+    free(raw);
+    return ok && trace->count == header->stats.records && at == size && stats.taken == header->stats.taken &&
+           stats.hash == header->stats.hash ? 0 : -1;
+}
+
+ /**
+ * Loads the trace from byte start on; a binary trace (see trace.h) can only
+ * be loaded whole, or from its end when a resumed run has already simulated
+ * all of it (giving no records). With whole_lines a final line
+ * without its newline (one still being appended) is left out, and *end is
+ * set to the offset where parsing stopped.
+ * The record count is bounded by the number of lines, which sizes the mapping.
+ * Returns 0 on success, -1 if the file cannot be read or is malformed.
+ */
+
+static int load(const char *path, size_t start, int whole_lines, bp_trace *trace, size_t *end) {
+    memset(trace, 0, sizeof(*trace));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (off_t)start > st.st_size) {
+        close(fd);
+        return -1;
+    }
+    const char *text = NULL;
+    if (st.st_size > 0) {
+        text = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    trace_header header;
+    if ((size_t)st.st_size >= sizeof(header) && memcmp(text, TRACE_MAGIC, 4) == 0) {
+        // A binary trace has no lines to resume from, only its end
+        if (start == (size_t)st.st_size) {
+            munmap((void*)text, st.st_size);
+            if (end) *end = start;
+            return 0;
+        }
+        memcpy(&header, text, sizeof(header));
+        // Every record takes at least a byte inflated, and deflate shrinks no more than TRACE_MAX_RATIO times
+        uint64_t most = (uint64_t)(st.st_size - sizeof(header)) * TRACE_MAX_RATIO;
+        int ok = start == 0 && header.version == TRACE_VERSION && header.stats.records <= most &&
+                 header.stats.records < SIZE_MAX / (sizeof(unsigned long int) + 1);
+        trace->map_size = ok ? (header.stats.records + 1) * (sizeof(unsigned long int) + 1) : 0;
+        void *map = ok ? mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+        if (map != MAP_FAILED) {
+            trace->addrs = (unsigned long int*)map;
+            trace->taken = (unsigned char*)(trace->addrs + header.stats.records + 1);
+            ok = load_binary((const unsigned char*)text, st.st_size, &header, trace) == 0;
+        }
+        munmap((void*)text, st.st_size);
+        if (end) *end = st.st_size;
+        if (map == MAP_FAILED || !ok) {
+            if (map != MAP_FAILED) trace_free(trace);
+            memset(trace, 0, sizeof(*trace));
+            return -1;
+        }
+        return 0;
+    }
+
+    const char *first = text + start, *last = text + st.st_size;
+    if (whole_lines) {
+        while (last > first && last[-1] != '\n') last--;
+    }
+    if (end) *end = (size_t)(last - text);
+    size_t lines = 1 + (text ? trace_count_lines(first, (size_t)(last - first)) : 0);
+    trace->map_size = lines * (sizeof(unsigned long int) + 1);
+    void *map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        if (text) munmap((void*)text, st.st_size);
+        return -1;
+    }
+    trace->addrs = (unsigned long int*)map;
+    trace->taken = (unsigned char*)(trace->addrs + lines);
+    trace->count = text ? trace_parse(first, last, trace->addrs, trace->taken, lines) : 0;
+    if (text) munmap((void*)text, st.st_size);
+    if (trace->count == (size_t)-1) {
+        trace_free(trace);
+        return -1;
+    }
+    return 0;
+}
+
+ /**
+ * Returns 1 if path starts like a binary trace, 0 otherwise (including when
+ * it cannot be read).
+ */
+
+int trace_is_binary(const char *path) {
+    char magic[4];
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    int binary = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return binary;
+}
+
+ /**
+ * Reads the statistics stored in the header of a binary trace. Counts the
+ * file could not hold (see load) are refused, since callers size memory by
+ * them before the blocks are checked.
+ * Returns 0, or -1 if path is not a binary trace of this version.
+ */
+
+int trace_read_stats(const char *path, trace_stats *stats) {
+    trace_header header;
+    struct stat st;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    int ok = fstat(fileno(fp), &st) == 0 && fread(&header, sizeof(header), 1, fp) == 1 &&
+             memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0 && header.version == TRACE_VERSION &&
+             header.stats.records <= (uint64_t)(st.st_size - sizeof(header)) * TRACE_MAX_RATIO &&
+             header.stats.unique_pcs <= header.stats.records && header.stats.taken <= header.stats.records;
+    fclose(fp);
+    if (ok) *stats = header.stats;
+    return ok ? 0 : -1;
+}
+
+typedef struct scan_job{
+    const char        *data;
+    const size_t      *starts;          /* blocks + 1 offsets */
+    size_t            blocks;
+    size_t            next;             /* next block to parse, taken atomically */
+    trace_stats       *stats;           /* per block */
+    trace_pcs         pcs;
+    int               failed;
+    pthread_mutex_t   lock;
+}scan_job;
+
+static void *scan_thread(void *arg) {
+    scan_job *job = (scan_job*)arg;
+    size_t b;
+    while ((b = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->blocks) {
+        const char *p = job->data + job->starts[b];
+        size_t size = job->starts[b + 1] - job->starts[b];
+        size_t capacity = 1 + trace_count_lines(p, size), count = (size_t)-1;
+        unsigned long int *addrs = (unsigned long int*)malloc(capacity * sizeof(unsigned long int));
+        unsigned char *taken = (unsigned char*)malloc(capacity);
+        trace_pcs pcs = { NULL, 0 };
+        if (addrs && taken) count = trace_parse(p, p + size, addrs, taken, capacity);
+        int ok = count != (size_t)-1 && trace_pcs_add(&pcs, addrs, count) == 0;
+        if (ok) trace_stats_block(&job->stats[b], addrs, taken, count);
+        free(addrs);
+        free(taken);
+        pthread_mutex_lock(&job->lock);
+        job->failed |= !ok || trace_pcs_merge(&job->pcs, &pcs) != 0;
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+ /**
+ * Fills stats for the trace at path: from the header of a binary trace, or
+ * by parsing a text trace with one thread per online CPU, each taking the
+ * next block in turn.
+ * Returns 0, or -1 if the file cannot be read or is malformed.
+ */
+
+int trace_scan(const char *path, trace_stats *stats) {
+    if (trace_read_stats(path, stats) == 0) return 0;
+    memset(stats, 0, sizeof(*stats));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    if (size >= 4 && memcmp(data, TRACE_MAGIC, 4) == 0) {
+        // A binary trace of another version
+        munmap((void*)data, size);
+        return -1;
+    }
+
+    scan_job job;
+    memset(&job, 0, sizeof(job));
+    job.data = data;
+    size_t *starts = (size_t*)malloc((size / TRACE_BLOCK + 2) * sizeof(size_t));
+    for (size_t at = 0; starts && at < size; at += trace_cut(data + at, size - at)) starts[job.blocks++] = at;
+    job.stats = (trace_stats*)calloc(job.blocks + 1, sizeof(trace_stats));
+    if (!starts || !job.stats) {
+        free(starts);
+        free(job.stats);
+        munmap((void*)data, size);
+        return -1;
+    }
+    starts[job.blocks] = size;
+    job.starts = starts;
+    pthread_mutex_init(&job.lock, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (int)cpus : 1, started = 0;
+    if ((size_t)threads > job.blocks) threads = (int)job.blocks;
+    pthread_t *tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+    for (int i = 0; tids && i < threads; i++) started += pthread_create(&tids[started], NULL, scan_thread, &job) == 0;
+    if (started == 0) scan_thread(&job);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    free(tids);
+
+    for (size_t b = 0; b < job.blocks; b++) trace_stats_merge(stats, &job.stats[b]);
+    stats->unique_pcs = job.pcs.count;
+    trace_pcs_free(&job.pcs);
+    pthread_mutex_destroy(&job.lock);
+    free(starts);
+    free(job.stats);
+    munmap((void*)data, size);
+    return job.failed ? -1 : 0;
+}
+
+ /**
+ * Loads a whole text or binary trace into memory.
+ * Returns 0 on success, -1 if the file cannot be read or is malformed.
+ */
+
+int trace_load(const char *path, bp_trace *trace) {
+    return load(path, 0, 0, trace, NULL);
+}
+
+ /**
+ * Loads the complete lines of a text trace from byte offset start (which
+ * must itself start a line), for resuming after an earlier run. *end receives
+ * the offset just past the last complete line. A binary trace resumes from 0
+ * or from its end.
+ * Returns 0 on success, -1 if the file cannot be read, is shorter than start
+ * or is malformed.
+ */
+
+int trace_load_from(const char *path, size_t start, bp_trace *trace, size_t *end) {
+    return load(path, start, 1, trace, end);
+}
+
+ /**
+ * Copies a loaded trace into a new mapping of its own. The calling thread
+ * touches every page first, so on a NUMA machine the copy lives on that
+ * thread's node. Returns 0 on success, -1 if memory is exhausted.
+ */
+
+int trace_copy(const bp_trace *src, bp_trace *dst) {
+    memset(dst, 0, sizeof(*dst));
+    void *map = mmap(NULL, src->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return -1;
+    memcpy(map, src->addrs, src->map_size);
+    dst->count = src->count;
+    dst->map_size = src->map_size;
+    dst->addrs = (unsigned long int*)map;
+    dst->taken = (unsigned char*)map + (src->taken - (const unsigned char*)src->addrs);
+    return 0;
+}
+
+void trace_free(bp_trace *trace) {
+    if (trace->addrs) munmap(trace->addrs, trace->map_size);
+    memset(trace, 0, sizeof(*trace));
+}
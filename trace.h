@@ -0,0 +1,95 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bp.h"
+
+ /**
+ * A branch trace parsed into parallel arrays, ready for bp_batch.
+ * The arrays live in one shared anonymous mapping, so they can be handed to
+ * worker threads (or forked workers) without copying.
+ */
+
+typedef struct bp_trace{
+    size_t            count;
+    unsigned long int *addrs;
+    unsigned char     *taken;
+    size_t            map_size;
+}bp_trace;
+
+ /**
+ * What is known about a trace before simulating it. The hash chains one
+ * hash per block of records (a text trace is cut into blocks of TRACE_BLOCK
+ * bytes extended to the end of a line, see trace_cut), so a text trace and
+ * its conversion have the same statistics.
+ */
+
+typedef struct trace_stats{
+    uint64_t          records;
+    uint64_t          unique_pcs;
+    uint64_t          taken;
+    uint64_t          hash;
+}trace_stats;
+
+ /**
+ * A sorted set of distinct branch addresses.
+ */
+
+typedef struct trace_pcs{
+    unsigned long int *pcs;
+    size_t            count;
+}trace_pcs;
+
+ /**
+ * Binary trace ("BPTR"): a trace_header with the statistics of the whole
+ * trace, then blocks that decode on their own, each a trace_block followed
+ * by size bytes of zlib data. Inflated, a block holds a bitmap of the taken
+ * flags (bit i % 8 of byte i / 8) and then one LEB128 varint per record: the
+ * zigzag-encoded difference from the previous address of the block (the
+ * first from 0). Both CRC-32s, the record and taken counts and the hash are
+ * checked when the trace is loaded.
+ */
+
+#define TRACE_MAGIC "BPTR"
+#define TRACE_VERSION 2
+#define TRACE_BLOCK (8UL << 20)
+#define TRACE_ENCODED_BOUND(n) (((n) + 7) / 8 + 10 * (n))
+#define TRACE_MAX_RATIO 1032            /* most deflate can shrink its input */
+
+typedef struct trace_header{
+    char              magic[4];
+    uint32_t          version;
+    uint64_t          blocks;
+    trace_stats       stats;
+}trace_header;
+
+typedef struct trace_block{
+    uint32_t          records;
+    uint32_t          raw_size;         /* bytes once inflated */
+    uint32_t          size;             /* zlib bytes that follow */
+    uint32_t          raw_crc;          /* CRC-32 of the inflated bytes */
+    uint32_t          crc;              /* CRC-32 of the zlib bytes */
+    uint32_t          reserved;
+}trace_block;
+
+int trace_set_isa(bp_isa isa);
+size_t trace_count_lines(const char *p, size_t n);
+size_t trace_parse(const char *p, const char *end, unsigned long int *addrs, unsigned char *taken, size_t capacity);
+size_t trace_encode(const unsigned long int *addrs, const unsigned char *taken, size_t count, unsigned char *out);
+int trace_decode(const unsigned char *raw, size_t raw_size, size_t count, unsigned long int *addrs, unsigned char *taken);
+size_t trace_cut(const char *p, size_t left);
+void trace_stats_block(trace_stats *stats, const unsigned long int *addrs, const unsigned char *taken, size_t count);
+void trace_stats_merge(trace_stats *total, const trace_stats *block);
+int trace_pcs_add(trace_pcs *set, const unsigned long int *addrs, size_t count);
+int trace_pcs_merge(trace_pcs *set, trace_pcs *other);
+void trace_pcs_free(trace_pcs *set);
+int trace_read_stats(const char *path, trace_stats *stats);
+int trace_scan(const char *path, trace_stats *stats);
+int trace_is_binary(const char *path);
+int trace_load(const char *path, bp_trace *trace);
+int trace_load_from(const char *path, size_t start, bp_trace *trace, size_t *end);
+int trace_copy(const bp_trace *src, bp_trace *dst);
+void trace_free(bp_trace *trace);
+
+#endif
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mlog.h"
+#include "undo.h"
+
+#define UNDO_DELTA      0
+#define UNDO_SNAPSHOT   1
+#define UNDO_TABLE_BITS 3               /* enough for BP_NUM_TABLES */
+#define UNDO_VARINT_MAX 10
+#define UNDO_PATCH_CHUNK 256
+
+ /**
+ * Undo log: how the tables of one predictor evolve, branch by branch, so
+ * their state after any number of branches can be rebuilt without running
+ * the trace again. After an mlog_header ("BPUL") the file is a sequence of
+ * records, each starting with a LEB128 varint (skip << 1) | kind, where skip
+ * counts the branches since the previous record that changed nothing:
+ * - UNDO_DELTA: what the next branch changed. A varint run count follows,
+ *   then per run a varint (offset << UNDO_TABLE_BITS) | table, a varint
+ *   length and that many bytes, each the old value XOR the new one. XOR
+ *   deltas replay in either direction, so the state at any branch is
+ *   rebuilt from the nearest snapshot, before or after it.
+ * - UNDO_SNAPSHOT: a varint length and the complete predictor as written by
+ *   bp_save. One is taken before the first branch, one every interval
+ *   branches and one after the last.
+ * Only bytes training actually changed are recorded: the spans reported by
+ * bp_trained_spans are compared with a shadow copy of the tables.
+ */
+
+struct undo_log{
+    mlog              *out;
+    unsigned char     *shadow[BP_NUM_TABLES];
+    unsigned long int interval;
+    uint64_t          position;         /* branches recorded */
+    uint64_t          written;          /* position at the end of the last record */
+    uint64_t          snapshot;         /* position of the last snapshot */
+    unsigned char     *group;           /* runs of the branch being recorded */
+    size_t            length;
+    size_t            capacity;
+    int               failed;
+};
+
+typedef struct undo_snapshot{
+    uint64_t          position;
+    size_t            offset;           /* bp_save data */
+    size_t            length;
+    size_t            next;             /* first record after it */
+}undo_snapshot;
+
+struct undo_reader{
+    unsigned char     *data;
+    size_t            size;
+    undo_snapshot     *snapshots;
+    size_t            count;
+    uint64_t          branches;
+};
+
+static size_t encode_varint(unsigned char *at, uint64_t value) {
+    size_t n = 0;
+    do {
+        at[n] = (unsigned char)(value & 0x7f);
+        value >>= 7;
+        at[n++] |= value ? 0x80 : 0;
+    } while (value);
+    return n;
+}
+
+ /**
+ * Makes room for extra more bytes in the group buffer.
+ * Returns 0, or -1 if memory is exhausted.
+ */
+
+static int group_reserve(undo_log *log, size_t extra) {
+    if (log->length + extra <= log->capacity) return 0;
+    size_t capacity = log->capacity ? log->capacity : 4096;
+    while (capacity < log->length + extra) capacity *= 2;
+    unsigned char *group = (unsigned char*)realloc(log->group, capacity);
+    if (!group) return -1;
+    log->group = group;
+    log->capacity = capacity;
+    return 0;
+}
+
+static void write_snapshot(undo_log *log, const bp_predictor *bp) {
+    char *state = NULL;
+    size_t length = 0;
+    FILE *fp = open_memstream(&state, &length);
+    if (!fp) {
+        log->failed = 1;
+        return;
+    }
+    int ok = bp_save(bp, fp) == 0;
+    ok &= fclose(fp) == 0;
+    if (ok) {
+        mlog_varint(log->out, ((log->position - log->written) << 1) | UNDO_SNAPSHOT);
+        mlog_varint(log->out, length);
+        mlog_write(log->out, state, length);
+        log->written = log->position;
+        log->snapshot = log->position;
+    }
+    log->failed |= !ok;
+    free(state);
+}
+
+ /**
+ * Starts recording bp into path, with a full snapshot every interval
+ * branches (0 for only the first and last). Returns NULL if the file cannot
+ * be created or memory is exhausted.
+ */
+
+undo_log *undo_create(const char *path, const bp_predictor *bp, unsigned long int interval) {
+    undo_log *log = (undo_log*)calloc(1, sizeof(undo_log));
+    if (!log) return NULL;
+    for (int t = 0; t < BP_NUM_TABLES; t++) {
+        size_t size;
+        const unsigned char *table = bp_table(bp, (bp_table_id)t, &size);
+        if (!table) continue;
+        log->shadow[t] = (unsigned char*)malloc(size);
+        if (!log->shadow[t]) {
+            for (int i = 0; i < t; i++) free(log->shadow[i]);
+            free(log);
+            return NULL;
+        }
+        memcpy(log->shadow[t], table, size);
+    }
+    log->interval = interval;
+    log->out = mlog_open(path, "BPUL", 0);
+    if (!log->out) {
+        for (int t = 0; t < BP_NUM_TABLES; t++) free(log->shadow[t]);
+        free(log);
+        return NULL;
+    }
+    write_snapshot(log, bp);
+    return log;
+}
+
+ /**
+ * Records what training bp on pred changed; call it right after bp_update.
+ * Returns 0, or -1 if memory is exhausted (the log is then unusable).
+ */
+
+int undo_branch(undo_log *log, const bp_predictor *bp, const bp_prediction *pred) {
+    bp_span spans[BP_MAX_SPANS];
+    size_t nspans = bp_trained_spans(bp, pred, spans);
+    uint64_t runs = 0;
+    log->length = 0;
+    for (size_t s = 0; s < nspans; s++) {
+        const unsigned char *now = bp_table(bp, spans[s].table, NULL) + spans[s].offset;
+        unsigned char *old = log->shadow[spans[s].table] + spans[s].offset;
+        size_t i = 0;
+        while (i < spans[s].length) {
+            if (now[i] == old[i]) {
+                i++;
+                continue;
+            }
+            size_t start = i;
+            while (i < spans[s].length && now[i] != old[i]) i++;
+            if (group_reserve(log, 2 * UNDO_VARINT_MAX + (i - start)) != 0) {
+                log->failed = 1;
+                return -1;
+            }
+            log->length += encode_varint(log->group + log->length,
+                                         ((uint64_t)(spans[s].offset + start) << UNDO_TABLE_BITS) | spans[s].table);
+            log->length += encode_varint(log->group + log->length, i - start);
+            for (size_t k = start; k < i; k++) {
+                log->group[log->length++] = old[k] ^ now[k];
+                old[k] = now[k];
+            }
+            runs++;
+        }
+    }
+    if (runs) {
+        mlog_varint(log->out, ((log->position - log->written) << 1) | UNDO_DELTA);
+        mlog_varint(log->out, runs);
+        mlog_write(log->out, log->group, log->length);
+        log->written = log->position + 1;
+    }
+    log->position++;
+    if (log->interval && log->position - log->snapshot >= log->interval) write_snapshot(log, bp);
+    return 0;
+}
+
+ /**
+ * Takes the final snapshot of bp and closes the log.
+ * Returns 0 on success, -1 if anything could not be recorded or written.
+ */
+
+int undo_close(undo_log *log, const bp_predictor *bp) {
+    if (log->position != log->snapshot) write_snapshot(log, bp);
+    int failed = log->failed;
+    failed |= mlog_close(log->out) != 0;
+    for (int t = 0; t < BP_NUM_TABLES; t++) free(log->shadow[t]);
+    free(log->group);
+    free(log);
+    return failed ? -1 : 0;
+}
+
+static int get_varint(const undo_reader *reader, size_t *at, uint64_t *value) {
+    *value = 0;
+    for (unsigned int shift = 0; shift < 64 && *at < reader->size; shift += 7) {
+        unsigned char byte = reader->data[(*at)++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+ /**
+ * Reads the record at *at, which follows the first *position branches, and
+ * leaves *at on its contents. For a delta *branch is the branch it belongs
+ * to; a snapshot moves *position to where it was taken.
+ * Returns the kind, or -1 at the end of the log or on malformed data.
+ */
+
+static int next_record(const undo_reader *reader, size_t *at, uint64_t *position, uint64_t *branch) {
+    uint64_t tag;
+    if (*at >= reader->size || get_varint(reader, at, &tag) != 0) return -1;
+    if ((tag & 1) == UNDO_SNAPSHOT) {
+        *position += tag >> 1;
+        return UNDO_SNAPSHOT;
+    }
+    *branch = *position + (tag >> 1);
+    *position = *branch + 1;
+    return UNDO_DELTA;
+}
+
+ /**
+ * Reads the delta at *at and XORs it into bp's tables (when bp is not NULL),
+ * setting *touched if it overlaps watch (when watch is not NULL).
+ * Returns 0, or -1 on malformed data or a delta that does not fit bp.
+ */
+
+static int apply_delta(const undo_reader *reader, size_t *at, bp_predictor *bp, const bp_span *watch, int *touched) {
+    uint64_t runs, key, length;
+    if (get_varint(reader, at, &runs) != 0) return -1;
+    for (uint64_t r = 0; r < runs; r++) {
+        if (get_varint(reader, at, &key) != 0 || get_varint(reader, at, &length) != 0 || length > reader->size - *at) return -1;
+        bp_table_id table = (bp_table_id)(key & ((1u << UNDO_TABLE_BITS) - 1));
+        size_t offset = (size_t)(key >> UNDO_TABLE_BITS);
+        const unsigned char *delta = reader->data + *at;
+        *at += length;
+        if (watch && table == watch->table && offset < watch->offset + watch->length && watch->offset < offset + length) *touched = 1;
+        if (!bp) continue;
+        size_t size;
+        const unsigned char *current = bp_table(bp, table, &size);
+        if (!current || offset > size || length > size - offset) return -1;
+        for (size_t done = 0; done < length; done += UNDO_PATCH_CHUNK) {
+            unsigned char bytes[UNDO_PATCH_CHUNK];
+            size_t n = length - done < UNDO_PATCH_CHUNK ? length - done : UNDO_PATCH_CHUNK;
+            for (size_t k = 0; k < n; k++) bytes[k] = current[offset + done + k] ^ delta[done + k];
+            bp_patch(bp, table, offset + done, bytes, n);
+        }
+    }
+    return 0;
+}
+
+static int skip_snapshot(const undo_reader *reader, size_t *at, size_t *length) {
+    uint64_t value;
+    if (get_varint(reader, at, &value) != 0 || value > reader->size - *at) return -1;
+    *length = (size_t)value;
+    *at += *length;
+    return 0;
+}
+
+ /**
+ * Loads the undo log at path and indexes its snapshots. Returns NULL if the
+ * file cannot be read, is not an undo log or is truncated.
+ */
+
+undo_reader *undo_open(const char *path) {
+    undo_reader *reader = (undo_reader*)calloc(1, sizeof(undo_reader));
+    FILE *fp = fopen(path, "rb");
+    mlog_header header;
+    long size;
+    int ok = reader && fp && fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= (long)sizeof(header) && fseek(fp, 0, SEEK_SET) == 0;
+    if (ok) {
+        reader->size = (size_t)size;
+        reader->data = (unsigned char*)malloc(reader->size);
+        ok = reader->data && fread(reader->data, 1, reader->size, fp) == reader->size;
+    }
+    if (fp) fclose(fp);
+    if (ok) {
+        memcpy(&header, reader->data, sizeof(header));
+        ok = memcmp(header.magic, "BPUL", sizeof(header.magic)) == 0 && header.version == MLOG_VERSION;
+    }
+
+    size_t at = sizeof(header), capacity = 0;
+    uint64_t position = 0, branch;
+    int kind;
+    while (ok && (kind = next_record(reader, &at, &position, &branch)) >= 0) {
+        if (kind == UNDO_DELTA) {
+            ok = apply_delta(reader, &at, NULL, NULL, NULL) == 0;
+            continue;
+        }
+        if (reader->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            undo_snapshot *snapshots = (undo_snapshot*)realloc(reader->snapshots, capacity * sizeof(undo_snapshot));
+            if (!(ok = snapshots != NULL)) break;
+            reader->snapshots = snapshots;
+        }
+        undo_snapshot *s = &reader->snapshots[reader->count];
+        s->position = position;
+        ok = skip_snapshot(reader, &at, &s->length) == 0;
+        s->offset = at - s->length;
+        s->next = at;
+        reader->count++;
+    }
+    // A complete log starts and ends with a snapshot
+    ok = ok && at == reader->size && reader->count > 0 && reader->snapshots[0].position == 0 &&
+         reader->snapshots[reader->count - 1].position == position;
+    if (!ok) {
+        undo_free(reader);
+        return NULL;
+    }
+    reader->branches = position;
+    return reader;
+}
+
+ /**
+ * Returns the number of branches the log covers.
+ */
+
+uint64_t undo_branches(const undo_reader *reader) {
+    return reader->branches;
+}
+
+static bp_predictor *load_snapshot(const undo_reader *reader, const undo_snapshot *s) {
+    FILE *fp = fmemopen(reader->data + s->offset, s->length, "rb");
+    if (!fp) return NULL;
+    bp_predictor *bp = bp_load(fp);
+    fclose(fp);
+    return bp;
+}
+
+ /**
+ * Rebuilds the predictor whose tables are as they were after the first
+ * branch branches, rolling forward or back from the nearest snapshot. Global
+ * history and statistics are those of that snapshot.
+ * Returns NULL if the log is shorter or memory is exhausted.
+ */
+
+bp_predictor *undo_state(const undo_reader *reader, uint64_t branch) {
+    if (branch > reader->branches) return NULL;
+    size_t k = 0;
+    for (size_t i = 1; i < reader->count; i++) {
+        uint64_t best = reader->snapshots[k].position, p = reader->snapshots[i].position;
+        if ((p > branch ? p - branch : branch - p) < (best > branch ? best - branch : branch - best)) k = i;
+    }
+    const undo_snapshot *s = &reader->snapshots[k];
+    bp_predictor *bp = load_snapshot(reader, s);
+    if (!bp) return NULL;
+    uint64_t position, at_branch;
+    size_t at;
+    int ok = 1;
+
+    if (s->position <= branch) {
+        // Replay the deltas of branches s->position .. branch - 1
+        position = s->position;
+        at = s->next;
+        while (ok && next_record(reader, &at, &position, &at_branch) == UNDO_DELTA && at_branch < branch) {
+            ok = apply_delta(reader, &at, bp, NULL, NULL) == 0;
+        }
+    }
+    else {
+        // Undo the deltas of branches branch .. s->position - 1, latest first
+        size_t *offsets = NULL, count = 0, capacity = 0;
+        position = reader->snapshots[k - 1].position;
+        at = reader->snapshots[k - 1].next;
+        while (ok && next_record(reader, &at, &position, &at_branch) == UNDO_DELTA) {
+            if (at_branch >= branch) {
+                if (count == capacity) {
+                    capacity = capacity ? 2 * capacity : 1024;
+                    size_t *grown = (size_t*)realloc(offsets, capacity * sizeof(size_t));
+                    if (!(ok = grown != NULL)) break;
+                    offsets = grown;
+                }
+                offsets[count++] = at;
+            }
+            ok = apply_delta(reader, &at, NULL, NULL, NULL) == 0;
+        }
+        while (ok && count > 0) {
+            at = offsets[--count];
+            ok = apply_delta(reader, &at, bp, NULL, NULL) == 0;
+        }
+        free(offsets);
+    }
+    if (!ok) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    return bp;
+}
+
+static char *entry_text(const bp_predictor *bp, bp_table_id id, unsigned long int entry) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *fp = open_memstream(&text, &length);
+    if (!fp) return NULL;
+    bp_print_entry(bp, id, entry, fp);
+    if (fclose(fp) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+ /**
+ * Prints the value of one table entry (numbered as in bp_entry_span) before
+ * the first branch and after every branch that changed it, each line
+ * prefixed with the number of branches simulated so far.
+ * Returns 0, or -1 if the entry does not exist or memory is exhausted.
+ */
+
+int undo_history(const undo_reader *reader, bp_table_id id, unsigned long int entry, FILE *out) {
+    bp_predictor *bp = load_snapshot(reader, &reader->snapshots[0]);
+    bp_span span;
+    if (!bp || bp_entry_span(bp, id, entry, &span) != 0) {
+        bp_destroy(bp);
+        return -1;
+    }
+    char *last = entry_text(bp, id, entry);
+    int ok = last != NULL;
+    if (ok) fprintf(out, "0: %s", last);
+
+    uint64_t position = 0, branch;
+    size_t at = reader->snapshots[0].next, length;
+    int kind;
+    while (ok && (kind = next_record(reader, &at, &position, &branch)) >= 0) {
+        if (kind == UNDO_SNAPSHOT) {
+            ok = skip_snapshot(reader, &at, &length) == 0;
+            continue;
+        }
+        int touched = 0;
+        ok = apply_delta(reader, &at, bp, &span, &touched) == 0;
+        if (!ok || !touched) continue;
+        // A packed local history shares its bytes with its neighbours
+        char *text = entry_text(bp, id, entry);
+        if (!(ok = text != NULL)) break;
+        if (strcmp(text, last) != 0) fprintf(out, "%llu: %s", (unsigned long long)branch + 1, text);
+        free(last);
+        last = text;
+    }
+    free(last);
+    bp_destroy(bp);
+    return ok ? 0 : -1;
+}
+
+void undo_free(undo_reader *reader) {
+    if (!reader) return;
+    free(reader->data);
+    free(reader->snapshots);
+    free(reader);
+}
@@ -0,0 +1,23 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "bp.h"
+
+#define UNDO_DEFAULT_INTERVAL 65536
+
+typedef struct undo_log undo_log;
+typedef struct undo_reader undo_reader;
+
+undo_log *undo_create(const char *path, const bp_predictor *bp, unsigned long int interval);
+int undo_branch(undo_log *log, const bp_predictor *bp, const bp_prediction *pred);
+int undo_close(undo_log *log, const bp_predictor *bp);
+
+undo_reader *undo_open(const char *path);
+uint64_t undo_branches(const undo_reader *reader);
+bp_predictor *undo_state(const undo_reader *reader, uint64_t branch);
+int undo_history(const undo_reader *reader, bp_table_id id, unsigned long int entry, FILE *out);
+void undo_free(undo_reader *reader);
+
+#endif